@@ -0,0 +1,165 @@
+// EE122 Project 2 - aqm.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// aqm.c contains the active queue management policies the router can apply
+// to each queue instead of plain tail drop: RED, which drops arriving packets
+// early based on the average queue length, and CoDel, which drops packets at
+// the head of the queue when their sojourn time stays above a target.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/socket.h>
+#include "common.h"
+
+#define RED_WEIGHT 0.002 //EWMA weight of every queue length sample
+#define RED_MAX_P 0.1 //drop probability when the average reaches max_th
+#define CODEL_TARGET_NS (5 * ONE_MILLION) //5 ms acceptable standing queue delay
+#define CODEL_INTERVAL_NS (100 * ONE_MILLION) //100 ms, about one worst-case RTT
+
+//Set up the AQM policy called name ("none", "red" or "codel") for a queue
+//of at most max_q_size packets. Returns 0 on success, -1 for an unknown name.
+int aqm_init (struct aqm *aqm, const char *name, unsigned int max_q_size) {
+    memset(aqm, 0, sizeof (struct aqm));
+    if (strcmp(name, "none") == 0) {
+        aqm->policy = AQM_NONE;
+    } else if (strcmp(name, "red") == 0) {
+        aqm->policy = AQM_RED;
+        //thresholds at 1/4 and 3/4 of the queue, but at least one packet apart
+        aqm->min_th = max_q_size / 4.0;
+        aqm->max_th = 3.0 * max_q_size / 4.0;
+        if (aqm->max_th < aqm->min_th + 1) {
+            aqm->max_th = aqm->min_th + 1;
+        }
+    } else if (strcmp(name, "codel") == 0) {
+        aqm->policy = AQM_CODEL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+//Name of the policy in use, for printing statistics
+const char *aqm_name (struct aqm *aqm) {
+    switch (aqm->policy) {
+        case AQM_RED:
+            return "red";
+        case AQM_CODEL:
+            return "codel";
+        default:
+            return "none";
+    }
+}
+
+//RED early drop decision for an arriving packet. avg_q is an exponentially
+//weighted average of the queue length seen at every arrival; between min_th
+//and max_th the drop probability grows linearly up to RED_MAX_P, spread out
+//by the count of packets accepted since the last drop.
+int red_drop (struct aqm *aqm, unsigned int q_size) {
+    double p_b, p_a;
+
+    aqm->avg_q = (1 - RED_WEIGHT) * aqm->avg_q + RED_WEIGHT * q_size;
+    if (aqm->avg_q < aqm->min_th) {
+        aqm->count = 0;
+        return 0;
+    }
+    if (aqm->avg_q >= aqm->max_th) {
+        aqm->count = 0;
+        aqm->red_forced_drops++;
+        return 1;
+    }
+    aqm->count++;
+    p_b = RED_MAX_P * (aqm->avg_q - aqm->min_th) / (aqm->max_th - aqm->min_th);
+    p_a = aqm->count * p_b < 1 ? p_b / (1 - aqm->count * p_b) : 1;
+    if (rand() / (double)RAND_MAX < p_a) {
+        aqm->count = 0;
+        aqm->red_early_drops++;
+        return 1;
+    }
+    return 0;
+}
+
+//Enqueue a packet pool slot subject to the queue's AQM policy. The arrival time
+//is recorded in the pool for CoDel. Returns 0 if the packet was queued, 1 if it
+//was dropped (by RED or by tail drop), in which case the caller keeps the slot.
+int aqm_enqueue (struct aqm *aqm, unsigned int slot, struct router_q *q, unsigned int max_q_size, struct pkt_pool *pool, uint64_t now) {
+    if (aqm->policy == AQM_RED && red_drop(aqm, q->q_size)) {
+        q->drop_cnt++;
+        return 1;
+    }
+    pool->enq_ns[slot] = now;
+    return enqueue(slot, q, max_q_size);
+}
+
+//CoDel: next drop time, interval / sqrt(count) after t
+uint64_t codel_control_law (uint64_t t, unsigned int count) {
+    return t + (uint64_t)(CODEL_INTERVAL_NS / sqrt((double)count));
+}
+
+//CoDel: non-zero if the packet in slot has waited longer than the target for
+//at least a full interval. slot is -1 when the queue has run empty.
+int codel_ok_to_drop (struct aqm *aqm, int slot, struct router_q *q, struct pkt_pool *pool, uint64_t now) {
+    if (slot == -1 || now - pool->enq_ns[slot] < CODEL_TARGET_NS || q->q_size == 0) {
+        //sojourn time is below target, or only this packet was queued
+        aqm->first_above_ns = 0;
+        return 0;
+    }
+    if (aqm->first_above_ns == 0) {
+        aqm->first_above_ns = now + CODEL_INTERVAL_NS;
+        return 0;
+    }
+    return now >= aqm->first_above_ns;
+}
+
+//CoDel drops a packet at the head of the queue and returns its slot to the pool
+void codel_drop (struct aqm *aqm, unsigned int slot, struct router_q *q, struct pkt_pool *pool, uint64_t now) {
+    if (aqm->on_drop != NULL) {
+        aqm->on_drop(pool, slot, now);
+    }
+    pool_free(pool, slot);
+    q->drop_cnt++;
+    aqm->codel_drops++;
+}
+
+//Dequeue the head packet of a queue subject to its AQM policy. CoDel may drop
+//one or more head packets first. Returns the slot of the packet to send, or -1
+//if the queue is (or has been drained) empty.
+int aqm_dequeue (struct aqm *aqm, struct router_q *q, struct pkt_pool *pool, uint64_t now) {
+    int slot, ok_to_drop;
+
+    slot = dequeue(q);
+    if (aqm->policy != AQM_CODEL) {
+        return slot;
+    }
+    ok_to_drop = codel_ok_to_drop(aqm, slot, q, pool, now);
+    if (aqm->dropping) {
+        if (!ok_to_drop) {
+            //sojourn time below target, leave the dropping state
+            aqm->dropping = 0;
+        }
+        while (aqm->dropping && now >= aqm->drop_next_ns) {
+            codel_drop(aqm, slot, q, pool, now);
+            aqm->drop_count++;
+            slot = dequeue(q);
+            if (!codel_ok_to_drop(aqm, slot, q, pool, now)) {
+                aqm->dropping = 0;
+            } else {
+                aqm->drop_next_ns = codel_control_law(aqm->drop_next_ns, aqm->drop_count);
+            }
+        }
+    } else if (ok_to_drop) {
+        codel_drop(aqm, slot, q, pool, now);
+        slot = dequeue(q);
+        aqm->dropping = 1;
+        //restart close to the previous drop rate if we were dropping recently
+        //drop_next_ns may still be ahead of now, so compare the difference as signed
+        if (aqm->drop_count > 2 && (int64_t)(now - aqm->drop_next_ns) < (int64_t)(16 * CODEL_INTERVAL_NS)) {
+            aqm->drop_count -= 2;
+        } else {
+            aqm->drop_count = 1;
+        }
+        aqm->drop_next_ns = codel_control_law(now, aqm->drop_count);
+    }
+    return slot;
+}
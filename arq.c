@@ -0,0 +1,170 @@
+// EE122 Project 2 - arq.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// arq.c contains the parts of Sender 2's sliding window ARQ that do not touch
+// a socket or the clock: the adaptive timeout estimator, the Go-Back-N window
+// and the selective repeat window with its retransmit timers. Every function
+// takes the current time as an argument, so the simulator runs the same code on
+// its virtual clock.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/socket.h>
+#include "common.h"
+
+//Function to obtain the exponential avg of packet round-trip-times (in ms)
+//Used in estimating the sender window timeout time
+//Based on the equation A(n+1) = (1-b)*A(n) + b*T(n+1), where:
+//A(n) is the exponential average RTT, b is a pre-chosen parameter value (typically 0.875), T(n) is the RTT of the current packet
+double avg_round_trip_time(double avg_so_far, double curr_rtt, double b) {
+    double exp_avg = 0.0;
+    exp_avg = ((1-b)*avg_so_far) + (b*curr_rtt);
+    //printf("%s: average RTT is %f us\n", __func__, exp_avg);
+    return exp_avg;
+}
+
+//Function to obtain the exponential avg of round-trip-time deviation (in ms)
+//Used in estimating the sender window timeout time
+//Based on the equation D(n+1) = (1-b)*D(n) + b*|T(n+1) - A(n+1)|, where:
+//D(n) is the exponential average deviation, b is a pre-chosen parameter value (typically 0.75), T(n) is the RTT of the current packet
+double avg_deviation(double dev_so_far, double curr_rtt, double exp_avg, double b) {
+    double exp_dev = 0.0;
+    exp_dev = (1.0-b)*dev_so_far+ b*fabs(curr_rtt - exp_avg);
+    //printf("%s: deviation is %f ms\n", __func__, exp_dev);
+    return exp_dev;
+}
+
+//Function to obtain the timeout time for the Sender's sliding window (in ms)
+double timeout(double exp_avg_rtt, double deviation) {
+    double timeout_t = exp_avg_rtt + 4.0*deviation;
+    //printf("%s: timeout time is %f ms\n", __func__, timeout_t);
+    return timeout_t;
+}
+
+//Go-Back-N: allocate the send times of a window of up to MAX_WINDOW_SIZE packets.
+//Returns 0 on success, -1 if memory could not be allocated.
+int gbn_init(struct gbn_state *gbn) {
+    memset(gbn, 0, sizeof (struct gbn_state));
+    gbn->tx_ns = calloc(MAX_WINDOW_SIZE, sizeof (uint64_t));
+    return gbn->tx_ns == NULL ? -1 : 0;
+}
+
+//Go-Back-N: packet seq was (re)sent at now
+void gbn_sent(struct gbn_state *gbn, unsigned int seq, uint64_t now) {
+    gbn->tx_ns[seq % MAX_WINDOW_SIZE] = now;
+    if (SEQ_LT(seq, gbn->high_seq)) {
+        gbn->retransmits++;
+    } else {
+        gbn->high_seq = seq + 1;
+    }
+}
+
+//Go-Back-N: resend the window from beg_seq_no
+void gbn_rewind(struct gbn_state *gbn, unsigned int beg_seq_no, unsigned int *next_seq_no) {
+    *next_seq_no = beg_seq_no;
+    gbn->dup_acks = 0;
+    gbn->recovering = 1;
+    gbn->recover = gbn->high_seq;
+}
+
+//Go-Back-N: process one ACK with cumulative ACK ack_seq (host byte order). A
+//new cumulative ACK slides the window to ack_seq and credits the congestion
+//controller with every packet it covers. The GBN_DUP_ACKS-th duplicate ACK of
+//the window start is a loss: the controller is told and the window is resent
+//from *beg_seq_no. Returns 1 if the window was rewound, otherwise 0.
+int gbn_on_ack(struct gbn_state *gbn, struct cong_ctrl *cc, unsigned int ack_seq, unsigned int *beg_seq_no, unsigned int *next_seq_no,
+               uint64_t rtt_ns, uint64_t now) {
+    unsigned int acked;
+
+    if (SEQ_LT(*beg_seq_no, ack_seq)) {
+        //packets sent before a rewind may acknowledge past next_seq_no
+        acked = ack_seq - *beg_seq_no;
+        *beg_seq_no = ack_seq;
+        if (SEQ_LT(*next_seq_no, ack_seq)) {
+            *next_seq_no = ack_seq;
+        }
+        gbn->dup_acks = 0;
+        if (gbn->recovering && SEQ_LT(gbn->recover, ack_seq)) {
+            gbn->recovering = 0;
+        }
+        cc_on_ack(cc, acked, rtt_ns, now);
+        return 0;
+    }
+    if (ack_seq != *beg_seq_no || *next_seq_no == *beg_seq_no || gbn->recovering) {
+        return 0; //an old ACK, nothing is outstanding, or an ACK of a resent copy
+    }
+    if (++gbn->dup_acks != GBN_DUP_ACKS) {
+        return 0;
+    }
+    cc_on_loss(cc, now);
+    gbn_rewind(gbn, *beg_seq_no, next_seq_no);
+    return 1;
+}
+
+//Go-Back-N: if the oldest unacknowledged packet was sent timeout_ns or more
+//before now, tell the congestion controller and rewind *next_seq_no to
+//beg_seq_no so the whole window is resent. Returns 1 if it did.
+int gbn_on_timeout(struct gbn_state *gbn, struct cong_ctrl *cc, unsigned int beg_seq_no, unsigned int *next_seq_no, uint64_t timeout_ns, uint64_t now) {
+    if (*next_seq_no == beg_seq_no || now < gbn_deadline(gbn, beg_seq_no, timeout_ns)) {
+        return 0;
+    }
+    cc_on_timeout(cc, now);
+    gbn_rewind(gbn, beg_seq_no, next_seq_no);
+    return 1;
+}
+
+//Go-Back-N: when the retransmit timer of the window starting at beg_seq_no expires
+uint64_t gbn_deadline(struct gbn_state *gbn, unsigned int beg_seq_no, uint64_t timeout_ns) {
+    return gbn->tx_ns[beg_seq_no % MAX_WINDOW_SIZE] + timeout_ns;
+}
+
+//Selective repeat: allocate the state for windows of up to max_window packets.
+//Returns 0 on success, -1 if memory could not be allocated.
+int sr_init(struct sr_state *sr, unsigned int max_window, uint64_t now) {
+    memset(sr, 0, sizeof (struct sr_state));
+    if (seqw_init(&sr->acked, max_window) == -1) {
+        return -1;
+    }
+    sr->backoff = calloc(sr->acked.capacity, 1);
+    if (sr->backoff == NULL || tw_init(&sr->rtx_wheel, RTX_WHEEL_SLOTS, RTX_TICK_NS, sr->acked.capacity, now) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+//Selective repeat: (re)start the retransmit timer of packet seq, sent at now.
+//A resent packet waits twice as long as the previous time before it is resent
+//again, so a timeout below the real RTT does not flood the queue.
+void sr_arm(struct sr_state *sr, unsigned int seq, uint64_t rto_ns, int resend, uint64_t now) {
+    unsigned int slot = seq & sr->acked.mask;
+
+    if (!resend) {
+        sr->backoff[slot] = 0;
+    } else if (sr->backoff[slot] < RTX_MAX_BACKOFF) {
+        sr->backoff[slot]++;
+    }
+    tw_arm(&sr->rtx_wheel, slot, now + (rto_ns << sr->backoff[slot]));
+}
+
+//Selective repeat: process an ACK with cumulative ACK ack_seq (host byte order)
+//and SACK bitmap sack. Stops the timers of every packet it acknowledges and
+//returns the new start of the window.
+unsigned int sr_on_ack(struct sr_state *sr, unsigned int ack_seq, unsigned char *sack, unsigned int next_seq_no) {
+    unsigned int seq, cum_ack, i;
+
+    cum_ack = SEQ_LT(ack_seq, next_seq_no) ? ack_seq : next_seq_no;
+    for (seq = sr->acked.base; SEQ_LT(seq, cum_ack); seq++) {
+        tw_cancel(&sr->rtx_wheel, seq & sr->acked.mask);
+    }
+    seqw_ack_upto(&sr->acked, cum_ack);
+    for (i = 0; i < SACK_BITS && SEQ_LT(ack_seq + 1 + i, next_seq_no); i++) {
+        seq = ack_seq + 1 + i;
+        if (SACK_TEST(sack, i) && seqw_set(&sr->acked, seq) == 1) {
+            tw_cancel(&sr->rtx_wheel, seq & sr->acked.mask);
+        }
+    }
+    seqw_advance(&sr->acked);
+    return sr->acked.base;
+}
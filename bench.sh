@@ -0,0 +1,151 @@
+#!/bin/bash
+# EE122 Project 2 - bench.sh
+# Xiaodian (Yinyin) Wang and Arnab Mukherji
+#
+# bench.sh is the end-to-end benchmark run by "make bench". It starts the
+# router, the receivers and the load generator on loopback and measures:
+#  1. an offered load sweep: loadgen sends constant-rate flows through the
+#     event-driven router (dq_time 0, batched) to receiver3, one step per rate.
+#     Every step reports the achieved rate, losses and one-way latency
+#     percentiles; the highest rate with no loss is the max lossless pkts/sec.
+#  2. goodput of Go-Back-N sender2 (through receiver2) against open-loop
+#     sender1 (through receiver1), both at the same mean inter-packet time.
+# The results are written as JSON to out_file so runs can be compared across
+# changes. As root every run is in its own network namespace, so nothing else
+# on the host's loopback interferes (and a stray receiver does not break it).
+#
+# Usage: ./bench.sh [bin_dir] [out_file]
+# bin_dir holds the binaries under test [bench], out_file the results [bench_results.json]
+# Environment: BENCH_RATES (offered loads in pkts/sec), BENCH_STEP_SEC [3],
+# BENCH_FLOWS [64], BENCH_PAYLOAD [104], BENCH_R_MS (sender1/sender2 mean
+# inter-packet time) [1], BENCH_GOODPUT_SEC [10]
+
+BIN_DIR=${1:-bench}
+OUT=${2:-bench_results.json}
+RATES=${BENCH_RATES:-"1000 2000 5000 10000 20000 50000 100000 200000 500000"}
+STEP_SEC=${BENCH_STEP_SEC:-3}
+FLOWS=${BENCH_FLOWS:-64}
+PAYLOAD=${BENCH_PAYLOAD:-104}
+R_MS=${BENCH_R_MS:-1}
+GOODPUT_SEC=${BENCH_GOODPUT_SEC:-10}
+
+for prog in router receiver1 receiver2 receiver3 sender1 sender2 loadgen; do
+    if [ ! -x "$BIN_DIR/$prog" ]; then
+        echo "bench.sh: $BIN_DIR/$prog not found, run make bench" >&2
+        exit 1
+    fi
+done
+if [ "$(id -u)" -eq 0 ] && [ -z "$BENCH_NETNS" ] && unshare -n true 2> /dev/null; then
+    BENCH_NETNS=1 exec unshare -n "$0" "$@"
+fi
+if [ -n "$BENCH_NETNS" ]; then
+    ip link set lo up
+fi
+
+# Number following the word $3 on the first line of file $1 containing $2
+stat_of() {
+    grep -m1 -- "$2" "$1" | sed -n "s/.*$3 \([0-9.]*\).*/\1/p"
+}
+
+# Stop the programs with pids $@ with SIGINT so they print their statistics
+stop() {
+    kill -INT "$@" 2> /dev/null
+    wait "$@" 2> /dev/null
+}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+# 1. Offered load sweep
+sweep_json=""
+max_lossless=0
+max_lossless_rate=""
+lossy_steps=0
+for rate in $RATES; do
+    "$BIN_DIR/router" 1 0 1000 -e -b 32 > "$dir/router.out" 2>&1 &
+    router_pid=$!
+    "$BIN_DIR/receiver3" -w 1 1 > "$dir/rx.out" 2>&1 &
+    rx_pid=$!
+    sleep 0.3
+    mean_ms=$(awk -v f="$FLOWS" -v r="$rate" 'BEGIN { printf "%.6f", f * 1000.0 / r }')
+    "$BIN_DIR/loadgen" -f "$FLOWS:constant:$mean_ms:1" -d "$STEP_SEC" -s 1 -l "$PAYLOAD" 127.0.0.1 > "$dir/lg.out" 2>&1
+    # let the router drain its queue before counting
+    sleep 0.5
+    stop $rx_pid
+    stop $router_pid
+
+    sent=$(stat_of "$dir/lg.out" "Loadgen stats: sent" sent)
+    sent_pps=$(grep -m1 "Loadgen stats: sent" "$dir/lg.out" | sed -n 's/.*sec (\([0-9.]*\) pkts\/sec).*/\1/p')
+    rcvd=$(stat_of "$dir/rx.out" "Receiver 3 stats: received" received)
+    drops=$(stat_of "$dir/router.out" "Q1 drop count" count)
+    p50=$(stat_of "$dir/rx.out" "Receiver 3 stats: packet delay" p50)
+    p99=$(stat_of "$dir/rx.out" "Receiver 3 stats: packet delay" p99)
+    p999=$(stat_of "$dir/rx.out" "Receiver 3 stats: packet delay" p99.9)
+    sent=${sent:-0}
+    rcvd=${rcvd:-0}
+    lost=$((sent - rcvd))
+    printf "bench.sh: offered %7s pkts/sec | sent %9s pkts/sec | lost %7d pkts | router drops %s | latency p50 %s p99 %s p99.9 %s nsec\n" \
+           "$rate" "$sent_pps" "$lost" "${drops:-0}" "$p50" "$p99" "$p999" >&2
+    sweep_json="$sweep_json${sweep_json:+,
+}    {\"offered_pps\": $rate, \"sent_pkts\": $sent, \"sent_pps\": ${sent_pps:-0}, \"received_pkts\": $rcvd, \"lost_pkts\": $lost, \"router_drops\": ${drops:-0}, \"latency_p50_ns\": ${p50:-null}, \"latency_p99_ns\": ${p99:-null}, \"latency_p999_ns\": ${p999:-null}}"
+    if [ "$sent" -gt 0 ] && [ "$lost" -eq 0 ]; then
+        if awk -v a="$sent_pps" -v b="$max_lossless" 'BEGIN { exit !(a > b) }'; then
+            max_lossless=$sent_pps
+            max_lossless_rate=$rate
+            lossless_p50=$p50
+            lossless_p99=$p99
+            lossless_p999=$p999
+        fi
+        lossy_steps=0
+    else
+        # two lossy steps in a row: the higher rates will not do better
+        lossy_steps=$((lossy_steps + 1))
+        if [ $lossy_steps -ge 2 ]; then
+            break
+        fi
+    fi
+done
+
+# 2. Goodput of sender2 (Go-Back-N) and sender1 at the same offered load. The
+# router forwards as fast as packets arrive, so the protocols are the limit.
+"$BIN_DIR/router" 2 0 1000 -e > "$dir/router.out" 2>&1 &
+router_pid=$!
+"$BIN_DIR/receiver1" 1 > "$dir/r1.out" 2>&1 &
+r1_pid=$!
+"$BIN_DIR/receiver2" 2 127.0.0.1 32 > "$dir/r2.out" 2>&1 &
+r2_pid=$!
+sleep 0.3
+timeout -s INT "$GOODPUT_SEC" "$BIN_DIR/sender2" -m gbn -l "$PAYLOAD" 2 "$R_MS" 2 127.0.0.1 32 "$R_MS" none > "$dir/s2.out" 2>&1
+# sender1 pauses 5 seconds before its first sending period of GOODPUT_SEC
+"$BIN_DIR/sender1" -l "$PAYLOAD" 1 "$R_MS" 1 127.0.0.1 "$GOODPUT_SEC" > /dev/null 2>&1 &
+s1_pid=$!
+sleep $((5 + GOODPUT_SEC))
+# sender1 has no SIGINT handler and ignores SIGINT in the background
+kill $s1_pid 2> /dev/null
+wait $s1_pid 2> /dev/null
+sleep 0.5
+stop $r1_pid $r2_pid $router_pid
+s2_goodput=$(stat_of "$dir/s2.out" goodput goodput)
+s1_rcvd=$(stat_of "$dir/r1.out" "Receiver 1 stats" received)
+s1_goodput=$(awk -v n="${s1_rcvd:-0}" -v t="$GOODPUT_SEC" 'BEGIN { printf "%.1f", n / t }')
+echo "bench.sh: goodput at r = $R_MS ms | sender1 (open loop) $s1_goodput pkts/sec | sender2 (Go-Back-N) ${s2_goodput:-0} pkts/sec" >&2
+
+cat > "$OUT" <<EOF
+{
+  "date": "$(date -u +%Y-%m-%dT%H:%M:%SZ)",
+  "commit": "$(git rev-parse --short HEAD 2> /dev/null)",
+  "host": "$(uname -n)",
+  "cpus": $(nproc),
+  "payload_bytes": $PAYLOAD,
+  "flows": $FLOWS,
+  "step_sec": $STEP_SEC,
+  "load_sweep": [
+$sweep_json
+  ],
+  "max_lossless_pps": $max_lossless,
+  "max_lossless_offered_pps": ${max_lossless_rate:-null},
+  "latency_at_max_lossless_ns": {"p50": ${lossless_p50:-null}, "p99": ${lossless_p99:-null}, "p999": ${lossless_p999:-null}},
+  "goodput": {"r_ms": $R_MS, "sec": $GOODPUT_SEC, "sender1_pps": $s1_goodput, "sender2_gbn_pps": ${s2_goodput:-0}}
+}
+EOF
+echo "bench.sh: max lossless $max_lossless pkts/sec, results in $OUT" >&2
@@ -0,0 +1,248 @@
+// EE122 Project 2 - cc.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// cc.c contains the congestion controllers Sender 2 can use to size its
+// sliding window: a fixed window, the original AIMD, Reno-style AIMD with slow
+// start, CUBIC, and a delay-based controller driven by the RTT samples.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/socket.h>
+#include "common.h"
+
+#define CUBIC_C 0.4 //scaling constant, windows in packets and time in seconds
+#define CUBIC_BETA 0.7 //window kept after a loss
+#define DELAY_ALPHA 2.0 //grow while fewer packets than this are queued on the path
+#define DELAY_BETA 4.0 //shrink while more packets than this are queued on the path
+#define DELAY_MIN_RTT_WINDOW_NS (10 * ONE_BILLION) //forget the minimum RTT after 10 s
+
+//Keep the window inside [min_cwnd, max_cwnd]
+void cc_clamp(struct cong_ctrl *cc) {
+    if (cc->cwnd < cc->min_cwnd) {
+        cc->cwnd = cc->min_cwnd;
+    }
+    if (cc->cwnd > cc->max_cwnd) {
+        cc->cwnd = cc->max_cwnd;
+    }
+}
+
+//Non-zero if the window was already reduced within the last RTT, so one burst
+//of losses only counts as a single congestion event
+int cc_recently_reduced(struct cong_ctrl *cc, uint64_t now) {
+    return cc->last_reduce_ns != 0 && now - cc->last_reduce_ns < cc->srtt_ns;
+}
+
+//Fixed window: the window given on the command line is never changed
+void fixed_event(struct cong_ctrl *cc, uint64_t now) {
+}
+
+void fixed_on_ack(struct cong_ctrl *cc, unsigned int acked, uint64_t rtt_ns, uint64_t now) {
+}
+
+//Original AIMD: one packet more per in-order ACK, half the window on every
+//out-of-order ACK, and timeouts leave the window alone
+void aimd_on_ack(struct cong_ctrl *cc, unsigned int acked, uint64_t rtt_ns, uint64_t now) {
+    cc->cwnd += acked;
+}
+
+void aimd_on_loss(struct cong_ctrl *cc, uint64_t now) {
+    cc->cwnd = floor(cc->cwnd / 2);
+}
+
+//Reno: slow start doubles the window every RTT up to ssthresh, then congestion
+//avoidance adds one packet per RTT. A loss halves the window, a timeout
+//restarts slow start from the minimum window.
+void reno_on_ack(struct cong_ctrl *cc, unsigned int acked, uint64_t rtt_ns, uint64_t now) {
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += acked;
+    } else {
+        cc->cwnd += (double)acked / cc->cwnd;
+    }
+}
+
+void reno_on_loss(struct cong_ctrl *cc, uint64_t now) {
+    if (cc_recently_reduced(cc, now)) {
+        return;
+    }
+    cc->ssthresh = cc->cwnd / 2;
+    if (cc->ssthresh < cc->min_cwnd) {
+        cc->ssthresh = cc->min_cwnd;
+    }
+    cc->cwnd = cc->ssthresh;
+    cc->last_reduce_ns = now;
+}
+
+void reno_on_timeout(struct cong_ctrl *cc, uint64_t now) {
+    reno_on_loss(cc, now);
+    cc->cwnd = cc->min_cwnd;
+}
+
+//CUBIC: after a loss the window follows W(t) = C (t - K)^3 + W_max, where t is
+//the time since the loss and K the time at which it gets back to W_max, so it
+//grows quickly far from the last loss point and slowly close to it. It never
+//grows slower than Reno would (the TCP-friendly window).
+void cubic_on_ack(struct cong_ctrl *cc, unsigned int acked, uint64_t rtt_ns, uint64_t now) {
+    double t, target, w_est;
+
+    if (cc->cwnd < cc->ssthresh) {
+        cc->cwnd += acked;
+        return;
+    }
+    if (cc->epoch_start_ns == 0) {
+        cc->epoch_start_ns = now;
+        if (cc->cwnd < cc->w_max) {
+            cc->k = cbrt((cc->w_max - cc->cwnd) / CUBIC_C);
+            cc->origin = cc->w_max;
+        } else {
+            cc->k = 0;
+            cc->origin = cc->cwnd;
+        }
+        cc->w_est = cc->cwnd;
+    }
+    t = (double)(now - cc->epoch_start_ns + cc->srtt_ns) / ONE_BILLION;
+    target = cc->origin + CUBIC_C * (t - cc->k) * (t - cc->k) * (t - cc->k);
+    if (target > cc->cwnd) {
+        cc->cwnd += (target - cc->cwnd) * acked / cc->cwnd;
+    } else {
+        cc->cwnd += 0.01 * acked / cc->cwnd;
+    }
+    //Reno-equivalent window with the same average rate
+    cc->w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * acked / cc->cwnd;
+    w_est = cc->w_est;
+    if (w_est > cc->cwnd) {
+        cc->cwnd = w_est;
+    }
+}
+
+void cubic_on_loss(struct cong_ctrl *cc, uint64_t now) {
+    if (cc_recently_reduced(cc, now)) {
+        return;
+    }
+    cc->w_max = cc->cwnd;
+    cc->cwnd *= CUBIC_BETA;
+    cc->ssthresh = cc->cwnd;
+    cc->epoch_start_ns = 0;
+    cc->last_reduce_ns = now;
+}
+
+void cubic_on_timeout(struct cong_ctrl *cc, uint64_t now) {
+    cubic_on_loss(cc, now);
+    cc->cwnd = cc->min_cwnd;
+}
+
+//Delay-based: the difference between the RTT and the minimum RTT tells how many
+//of the window's packets sit in queues (diff = cwnd * (1 - min_rtt / rtt)).
+//Once per RTT the window grows by one while fewer than DELAY_ALPHA packets are
+//queued and shrinks by one while more than DELAY_BETA are, so the router queue
+//stays short instead of being filled until it drops. The minimum RTT expires
+//after DELAY_MIN_RTT_WINDOW_NS so a route change is picked up.
+void delay_on_ack(struct cong_ctrl *cc, unsigned int acked, uint64_t rtt_ns, uint64_t now) {
+    double diff;
+
+    if (rtt_ns == 0) {
+        return;
+    }
+    if (cc->min_rtt_ns == 0 || rtt_ns <= cc->min_rtt_ns || now - cc->min_rtt_stamp_ns > DELAY_MIN_RTT_WINDOW_NS) {
+        cc->min_rtt_ns = rtt_ns;
+        cc->min_rtt_stamp_ns = now;
+    }
+    if (now - cc->epoch_start_ns < cc->srtt_ns) {
+        return; //adjust once per RTT
+    }
+    cc->epoch_start_ns = now;
+    diff = cc->cwnd * (1.0 - (double)cc->min_rtt_ns / rtt_ns);
+    if (cc->cwnd < cc->ssthresh && diff < 1) {
+        cc->cwnd *= 2; //slow start until the first queue builds up
+    } else if (diff < DELAY_ALPHA) {
+        cc->ssthresh = cc->cwnd;
+        cc->cwnd += 1;
+    } else if (diff > DELAY_BETA) {
+        cc->ssthresh = cc->cwnd;
+        cc->cwnd -= 1;
+    }
+}
+
+void delay_on_loss(struct cong_ctrl *cc, uint64_t now) {
+    if (cc_recently_reduced(cc, now)) {
+        return;
+    }
+    cc->cwnd *= 0.75;
+    cc->ssthresh = cc->cwnd;
+    cc->last_reduce_ns = now;
+}
+
+void delay_on_timeout(struct cong_ctrl *cc, uint64_t now) {
+    delay_on_loss(cc, now);
+    cc->cwnd = cc->min_cwnd;
+}
+
+//An ACK acknowledged acked new packets, rtt_ns is its RTT sample (0 if none)
+void cc_on_ack(struct cong_ctrl *cc, unsigned int acked, uint64_t rtt_ns, uint64_t now) {
+    if (rtt_ns > 0) {
+        //smoothed RTT used to limit reductions to one per RTT
+        cc->srtt_ns = cc->srtt_ns == 0 ? rtt_ns : (7 * cc->srtt_ns + rtt_ns) / 8;
+    }
+    cc->on_ack(cc, acked, rtt_ns, now);
+    cc_clamp(cc);
+}
+
+//The ACKs show a packet was lost (an out-of-order or duplicate ACK)
+void cc_on_loss(struct cong_ctrl *cc, uint64_t now) {
+    cc->on_loss(cc, now);
+    cc_clamp(cc);
+}
+
+//A retransmit timer expired
+void cc_on_timeout(struct cong_ctrl *cc, uint64_t now) {
+    cc->on_timeout(cc, now);
+    cc_clamp(cc);
+}
+
+//Current window in whole packets
+unsigned int cc_window(struct cong_ctrl *cc) {
+    return (unsigned int)cc->cwnd;
+}
+
+//Set up the congestion controller called name for an initial window of
+//init_cwnd packets that must stay within [min_cwnd, max_cwnd]. name is "none",
+//"aimd", "reno", "cubic" or "delay"; "0" and "1" are accepted for "none" and
+//"aimd", the old AIMD option values. Returns 0 on success, -1 if the name is unknown.
+int cc_init(struct cong_ctrl *cc, const char *name, unsigned int init_cwnd, unsigned int min_cwnd, unsigned int max_cwnd) {
+    memset(cc, 0, sizeof (struct cong_ctrl));
+    cc->cwnd = init_cwnd;
+    cc->min_cwnd = min_cwnd;
+    cc->max_cwnd = max_cwnd;
+    cc->ssthresh = max_cwnd;
+    if (strcmp(name, "none") == 0 || strcmp(name, "0") == 0) {
+        cc->name = "none";
+        cc->on_ack = fixed_on_ack;
+        cc->on_loss = fixed_event;
+        cc->on_timeout = fixed_event;
+    } else if (strcmp(name, "aimd") == 0 || strcmp(name, "1") == 0) {
+        cc->name = "aimd";
+        cc->on_ack = aimd_on_ack;
+        cc->on_loss = aimd_on_loss;
+        cc->on_timeout = fixed_event;
+    } else if (strcmp(name, "reno") == 0) {
+        cc->name = "reno";
+        cc->on_ack = reno_on_ack;
+        cc->on_loss = reno_on_loss;
+        cc->on_timeout = reno_on_timeout;
+    } else if (strcmp(name, "cubic") == 0) {
+        cc->name = "cubic";
+        cc->on_ack = cubic_on_ack;
+        cc->on_loss = cubic_on_loss;
+        cc->on_timeout = cubic_on_timeout;
+    } else if (strcmp(name, "delay") == 0) {
+        cc->name = "delay";
+        cc->on_ack = delay_on_ack;
+        cc->on_loss = delay_on_loss;
+        cc->on_timeout = delay_on_timeout;
+    } else {
+        return -1;
+    }
+    cc_clamp(cc);
+    return 0;
+}
@@ -6,41 +6,505 @@
 
 #ifndef _common_h
 #define _common_h
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #define ROUTER_PORT "6000"
 #define SENDER_PORT "7000"
+#define METRICS_PORT "6001"
 #define ONE_MILLION 1000000
+#define ONE_BILLION 1000000000ULL
+#define PACER_MAX_BURST 64 //gaps a pacer may fall behind before it stops catching up
 #define RECEIVER_PORT_BASE 5000
+#define CACHE_LINE_SIZE 64
+#define ARENA_HUGE_PAGE_SIZE (2 * 1024 * 1024)
 
-//UDP datagram payload format, 128 bytes total
+#define MSG_VERSION 3 //version 2 was a fixed 128-byte record, version 1 the gettimeofday sec/usec header
+#define MSG_MAX_LEN 1472 //largest datagram: a 1500-byte Ethernet MTU minus the IPv4 and UDP headers
+#define MSG_HDR_LEN offsetof(struct msg_payload, msg) //24 bytes
+#define MSG_MAX_PAYLOAD (MSG_MAX_LEN - MSG_HDR_LEN)
+#define DEFAULT_MSG_PAYLOAD 104 //payload bytes sent by default, a 128-byte datagram as in version 2
+
+//UDP datagram format, a 24-byte header followed by length bytes of payload, all
+//fields in network byte order. A datagram is exactly MSG_HDR_LEN + length bytes
+//long, so the struct is the largest one that fits in the path MTU and only the
+//header and the payload actually used are ever sent.
+//timestamp_ns is CLOCK_MONOTONIC at the sender, so one-way delays are only
+//meaningful when sender and receiver share a host (e.g. over loopback); the RTT
+//measured by echoing it back is valid between any hosts.
 struct msg_payload {
-    unsigned int seq; //packet Sequence ID, 4 bytes
-    unsigned int timestamp_sec; //seconds portion of timestamp, 4 bytes
-    unsigned int timestamp_usec; //microsec portion of timestamp, 4 bytes
-    unsigned int sender_id; //4 bytes
-    unsigned int receiver_id; //4 bytes
-    unsigned char msg[108];
-} __pack__; //pack so that the CPU does not assign spacing between fields
+    uint8_t version; //MSG_VERSION, 1 byte
+    uint8_t flags; //MSG_FLAG_* bits, 0 for data, 1 byte
+    uint16_t length; //payload bytes following the header, 2 bytes
+    uint32_t seq; //packet Sequence ID, 4 bytes
+    uint64_t timestamp_ns; //send time in nanoseconds, 8 bytes
+    uint32_t sender_id; //4 bytes
+    uint32_t receiver_id; //4 bytes
+    unsigned char msg[MSG_MAX_LEN - 24]; //payload, up to MSG_MAX_PAYLOAD bytes
+} __attribute__((packed)); //no padding anywhere, the layout is the wire format
+
+_Static_assert(sizeof (struct msg_payload) == MSG_MAX_LEN, "msg_payload must be exactly one MTU-sized datagram");
 
-//The router queue is a linked list data structure (router_q) with q_elem nodes
-struct q_elem { //q_elem is a linked list node
-    struct msg_payload *buffer; //this points to the actual received payload buffer
-    struct q_elem *next; //points to the next q elemenet in the linked list
+//Fixed-capacity packet pool. Every packet buffer the router needs is allocated
+//once at startup and handed out by slot index, so forwarding never calls malloc/free.
+struct pkt_pool {
+    struct msg_payload *pkts; //contiguous array of capacity packet buffers, in the arena
+    unsigned int *free_slots; //stack of the slot indices not currently in use
+    uint64_t *enq_ns; //monotonic time each slot's packet was enqueued, used by CoDel
+    unsigned int free_cnt; //number of entries in free_slots
+    unsigned int capacity; //total number of packet buffers in the pool
+    size_t arena_len; //bytes mapped for pkts, 0 for a view of another pool's arena
+    int arena_huge; //the arena is backed by explicit huge pages
+    //A view that does not own its slots hands every freed slot back to the
+    //thread that owns it, through owner_rings[slot / slots_per_owner]
+    struct spsc_ring *owner_rings;
+    unsigned int slots_per_owner;
 };
 
+//Packet buffer stored in a given pool slot
+#define POOL_PKT(pool, slot) (&(pool)->pkts[(slot)])
+
+//The router queue is a ring buffer (router_q) of packet pool slot indices
 struct router_q { 
-    struct q_elem *head; //points to the q header
-    struct q_elem *tail; // points to the q tail
-    unsigned int q_size; //number of q elements in the router_q linked-list
+    unsigned int *slots; //ring of pool slot indices, capacity entries long
+    unsigned int head; //ring index of the q head
+    unsigned int tail; //ring index one past the q tail
+    unsigned int capacity; //number of entries in the ring
+    unsigned int q_size; //number of packets in the router_q ring
     unsigned int drop_cnt; //how many received payloads that the buffer dropped
 };
 
+//Lock-free single-producer/single-consumer ring of fixed-size entries.
+//The producer only writes tail and the consumer only writes head, and the two
+//indices live on separate cache lines so the threads do not false-share.
+struct spsc_ring {
+    _Atomic unsigned int head __attribute__((aligned(CACHE_LINE_SIZE))); //next entry to pop
+    _Atomic unsigned int tail __attribute__((aligned(CACHE_LINE_SIZE))); //next entry to push
+    unsigned int mask __attribute__((aligned(CACHE_LINE_SIZE))); //capacity - 1, capacity is a power of 2
+    unsigned int entry_size; //bytes per entry
+    unsigned char *entries;
+};
+
+//Token bucket shaper. Tokens are packets, or bytes when byte_mode is set, and
+//accrue at rate tokens per second up to burst tokens.
+struct token_bucket {
+    double rate; //tokens per second
+    double burst; //maximum number of tokens held
+    double tokens; //tokens currently available, negative while a large packet is repaid
+    uint64_t last_ns; //monotonic time of the last refill
+    int byte_mode;
+};
+
+//Hashed timer wheel with a fixed set of timers identified by 0..n_timers-1.
+//A timer armed for a deadline lands in the slot of its tick; timers more than
+//one rotation ahead share a slot with nearer ones and are skipped until due.
+//Arming, cancelling and expiring a timer are all O(1).
+struct timer_wheel {
+    uint64_t tick_ns; //resolution of the wheel
+    uint64_t cur_tick; //next tick to be expired
+    unsigned int mask; //number of slots - 1, the number of slots is a power of 2
+    unsigned int armed_cnt;
+    int *slot_head; //first timer of every slot, -1 if the slot is empty
+    int *next, *prev; //doubly linked list of the timers in the same slot
+    uint64_t *expiry_tick; //tick at which each armed timer fires
+    unsigned char *armed;
+};
+
+//Reorder window over sequence numbers [base, base + capacity): a ring of bits,
+//bit seq & mask is set once seq has been received (receiver) or acknowledged
+//(sender). base is the lowest sequence number not yet set, i.e. the cumulative
+//ACK, and moves forward a 64-bit word at a time.
+struct seq_window {
+    uint64_t *bits; //capacity / 64 words
+    unsigned int capacity; //power of 2, at least 64
+    unsigned int mask; //capacity - 1
+    uint32_t base;
+    unsigned int count; //bits set, i.e. sequence numbers held beyond base
+};
+
+//Sequence number order that survives wrap-around: a comes before b if it is
+//less than 2^31 behind it
+#define SEQ_LT(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+
+//Selective acknowledgement bitmap of an ACK: bit i is set if cum_ack + 1 + i
+//has already been received, cum_ack being the next expected sequence number.
+//It covers the largest window, so selective repeat never resends a packet
+//only because it lies beyond the bitmap. Trailing empty bytes are not sent.
+#define SACK_BITS 4096
+#define SACK_SET(sack, i) ((sack)[(i) / 8] |= (unsigned char)(1 << ((i) % 8)))
+#define SACK_TEST(sack, i) ((sack)[(i) / 8] & (1 << ((i) % 8)))
+
+#define MSG_FLAG_ACK 0x01 //the datagram is a struct ack_payload
+
+//Compact ACK sent back by receiver2, all fields in network byte order. Only the
+//ACK_HDR_LEN byte header and the first sack_len bytes of sack are sent.
+struct ack_payload {
+    uint8_t version; //MSG_VERSION, 1 byte
+    uint8_t flags; //MSG_FLAG_ACK, 1 byte
+    uint16_t sack_len; //number of sack bytes sent, 2 bytes
+    uint32_t cum_ack; //next expected sequence number, 4 bytes
+    uint64_t echo_ns; //timestamp_ns of the newest data packet acknowledged, 8 bytes
+    uint32_t ack_delay_ns; //time the receiver held that packet before acking it, 4 bytes
+    unsigned char sack[SACK_BITS / 8]; //bit i: cum_ack + 1 + i has been received
+};
+
+#define ACK_HDR_LEN offsetof(struct ack_payload, sack)
+
+//Active queue management policy of a router queue, with its drop counters
+#define AQM_NONE 0
+#define AQM_RED 1
+#define AQM_CODEL 2
+
+struct aqm {
+    int policy;
+    //RED state: average queue length and thresholds, in packets
+    double avg_q, min_th, max_th;
+    unsigned int count; //packets accepted since the last RED drop
+    //CoDel state, times are monotonic nanoseconds
+    uint64_t first_above_ns; //when the sojourn time will have been above target for an interval
+    uint64_t drop_next_ns; //next drop while in the dropping state
+    unsigned int drop_count; //drops since entering the dropping state
+    int dropping;
+    //Drop counters per policy
+    unsigned long red_early_drops, red_forced_drops, codel_drops;
+    //called with every packet CoDel drops, before its slot is freed, if set
+    void (*on_drop)(struct pkt_pool *pool, unsigned int slot, uint64_t now);
+};
+
+//Per-queue router counters. They are written on the packet path with relaxed
+//atomics and read by the metrics exporter thread; each queue's counters start
+//on their own cache line so queues served by different threads do not false-share.
+#define SOJOURN_BUCKETS 32
+
+struct queue_metrics {
+    _Atomic unsigned long enqueued;
+    _Atomic unsigned long dropped;
+    _Atomic unsigned long forwarded;
+    _Atomic unsigned long forwarded_bytes;
+    _Atomic unsigned long depth; //queue length after the last enqueue or dequeue
+    _Atomic unsigned long sojourn_hist[SOJOURN_BUCKETS]; //bucket i: [2^i, 2^(i+1)) usec in the queue
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+//Streaming fixed-memory histogram (HDR style) for delays and queue lengths.
+//Values below HIST_SUB_COUNT are counted exactly; above that every power of two
+//is split into HIST_SUB_COUNT/2 linear buckets, so any value is recorded with a
+//relative error below 2/HIST_SUB_COUNT (about 1.6%). Values of 2^HIST_MAX_BITS
+//and above share the last bucket, the exact maximum is always kept.
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 36 //about 19 hours when recording microseconds
+#define HIST_BUCKETS (HIST_SUB_COUNT + (HIST_MAX_BITS - HIST_SUB_BITS) * (HIST_SUB_COUNT / 2))
+
+struct latency_hist {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total_count;
+    uint64_t min, max;
+    uint64_t sum; //64 bits, no overflow for any realistic run
+};
+
+//Scheduler interface: pick() returns the index of the queue the router should
+//dequeue from next, or -1 if every queue is empty. The router then reports the
+//packet it actually sent from that queue with sched_charge().
+struct scheduler {
+    const char *name;
+    int (*pick)(struct scheduler *sched, struct router_q *queues);
+    unsigned int q_amount; //number of queues being scheduled
+    struct pkt_pool *pool; //holds the queued packets, for their lengths
+    unsigned int current; //round-robin position
+    unsigned int quantum; //DRR credit per round, in bytes
+    int *deficit; //DRR deficit counter of each queue, in bytes, negative while in debt
+    int new_round; //DRR: the current queue has not been credited yet
+};
+
+//Congestion controller interface used by Sender 2 to size its sliding window.
+//on_ack() is called for every ACK that acknowledges new packets, on_loss() when
+//the ACKs show a lost packet and on_timeout() when a retransmit timer expires.
+struct cong_ctrl {
+    const char *name;
+    void (*on_ack)(struct cong_ctrl *cc, unsigned int acked, uint64_t rtt_ns, uint64_t now);
+    void (*on_loss)(struct cong_ctrl *cc, uint64_t now);
+    void (*on_timeout)(struct cong_ctrl *cc, uint64_t now);
+    double cwnd; //window in packets, fractional so it can grow by less than one per ACK
+    double ssthresh; //slow start threshold, in packets
+    unsigned int min_cwnd, max_cwnd;
+    uint64_t srtt_ns; //smoothed RTT
+    uint64_t last_reduce_ns; //time of the last window reduction
+    //CUBIC state: window before the last loss, time to get back to it, and the
+    //start of the current growth epoch (also the delay controller's last adjustment)
+    double w_max, k, origin, w_est;
+    uint64_t epoch_start_ns;
+    //Delay controller state: minimum RTT seen and when it was measured
+    uint64_t min_rtt_ns, min_rtt_stamp_ns;
+};
+
+//Memory-mapped TPACKET_V3 receive ring (pktring.c), the router's alternative
+//to receiving on the UDP socket
+struct pkt_ring {
+    int fd; //AF_PACKET socket, readable when a block is ready
+    unsigned char *map; //the ring of blocks shared with the kernel
+    size_t map_len;
+    unsigned int block_size, block_cnt;
+    unsigned int cur_block; //block being read, or waited for
+    struct tpacket3_hdr *frame; //next frame of cur_block, NULL if it has not been handed over yet
+    unsigned int frames_left; //frames of cur_block not read yet
+    uint16_t port; //UDP destination port, network byte order
+    unsigned long rx_blocks, bad_frames;
+};
+
+//Sliding window ARQ of Sender 2 (arq.c)
+#define MIN_WINDOW_SIZE 1
+#define MAX_WINDOW_SIZE 4096
+_Static_assert(SACK_BITS >= MAX_WINDOW_SIZE, "the SACK bitmap must cover the largest window");
+#define ARQ_GBN 0 //Go-Back-N
+#define ARQ_SR 1 //selective repeat
+#define RTX_TICK_NS ONE_MILLION //1 ms resolution of the retransmit timers
+#define RTX_WHEEL_SLOTS 1024
+#define RTX_MAX_BACKOFF 6 //a packet's timeout doubles per resend, up to 64 times
+#define GBN_DUP_ACKS 3 //duplicate ACKs that signal a lost packet to Go-Back-N
+
+//Go-Back-N sender state. The window itself is [beg_seq_no, next_seq_no) of the
+//caller; tx_ns[seq % MAX_WINDOW_SIZE] is when packet seq was last sent, so the
+//retransmit timer runs from the oldest unacknowledged transmission.
+struct gbn_state {
+    uint64_t *tx_ns;
+    unsigned int high_seq; //one past the highest packet ever sent
+    unsigned int dup_acks; //duplicate ACKs of beg_seq_no received in a row
+    //After a rewind the receiver ACKs the resent copies of packets it already
+    //holds, so duplicate ACKs mean nothing until the cumulative ACK passes recover
+    int recovering;
+    unsigned int recover;
+    unsigned long retransmits;
+};
+
+//Selective repeat sender state. acked is the send window: its base is the
+//oldest unacknowledged packet and a bit is set for every packet selectively
+//acknowledged beyond it. Window slot seq & acked.mask holds how often that
+//packet has been resent and its retransmit timer in rtx_wheel (the timer id is
+//the window slot).
+struct sr_state {
+    struct seq_window acked;
+    unsigned char *backoff;
+    struct timer_wheel rtx_wheel;
+    unsigned long retransmits;
+};
+
+//Pacing engine: send times are scheduled on the monotonic clock with
+//exponential gaps (a Poisson process) drawn from the pacer's own xoshiro256**
+//generator, so several pacers can run in different threads
+struct pacer {
+    uint64_t rng[4]; //xoshiro256** state
+    double mean_ns; //mean gap between sends
+    uint64_t next_ns; //absolute time of the next send
+};
+
+//Binary packet trace: a struct trace_file_hdr followed by struct trace_rec
+//records, both in host byte order. Timestamps are on the monotonic clock, so
+//the traces of all the programs on one host share a time base.
+#define TRACE_MAGIC "EE122TRC"
+#define TRACE_VERSION 1
+#define TRACE_TX 0 //a sender sent the packet
+#define TRACE_ENQ 1 //the router queued it
+#define TRACE_DROP 2 //the router dropped it on arrival (tail drop, RED, or a full ingress ring)
+#define TRACE_DEQ 3 //the router forwarded it
+#define TRACE_RX 4 //a receiver got it
+#define TRACE_ACK 5 //receiver2 sent, or sender2 received, an ACK; seq is the cumulative ACK
+#define TRACE_N_EVENTS 6
+
+struct trace_file_hdr {
+    char magic[8]; //TRACE_MAGIC, not NUL terminated
+    uint32_t version; //TRACE_VERSION
+    uint32_t rec_size; //sizeof (struct trace_rec)
+} __attribute__((packed));
+
+struct trace_rec {
+    uint64_t ts_ns; //monotonic time of the event
+    uint32_t sender_id;
+    uint32_t receiver_id;
+    uint32_t seq;
+    uint16_t size; //datagram length in bytes, header included
+    uint8_t event; //TRACE_TX ... TRACE_ACK
+    uint8_t thread; //index of the writing thread's buffer
+} __attribute__((packed));
+
+extern int trace_enabled;
+
 extern void *get_in_addr(struct sockaddr *sa); 
 
-extern int enqueue (struct q_elem *elem, struct router_q *q, unsigned int max_q_size);
+extern void *arena_map (size_t len, size_t *mapped, int *huge);
+
+extern int pool_init (struct pkt_pool *pool, unsigned int capacity);
+
+extern int pool_init_view (struct pkt_pool *view, struct pkt_pool *arena, unsigned int first, unsigned int count);
+
+extern int pool_alloc (struct pkt_pool *pool);
+
+extern void pool_free (struct pkt_pool *pool, unsigned int slot);
+
+extern int router_q_init (struct router_q *q, unsigned int capacity);
+
+extern int enqueue (unsigned int slot, struct router_q *q, unsigned int max_q_size);
 
-extern struct q_elem *dequeue (struct router_q *q);
+extern int dequeue (struct router_q *q);
 
-extern void poisson_delay (double mean);
+extern uint64_t xoshiro_next (uint64_t s[4]);
+
+extern void xoshiro_seed (uint64_t s[4], uint64_t seed);
+
+extern double xoshiro_uniform (uint64_t s[4]);
+
+extern void pacer_init (struct pacer *p, double mean_ms, uint64_t seed);
+
+extern int pacer_due (struct pacer *p, uint64_t now);
+
+extern void pacer_advance (struct pacer *p, uint64_t now);
+
+extern int pacer_sleep (struct pacer *p);
+
+extern int wait_readable (int fd, uint64_t deadline_ns);
+
+extern int pktring_open (struct pkt_ring *ring, const char *ifname, const char *port);
+
+extern const unsigned char *pktring_next (struct pkt_ring *ring, unsigned int *len);
+
+extern unsigned long pktring_drops (struct pkt_ring *ring);
+
+extern void pktring_close (struct pkt_ring *ring);
+
+extern uint64_t uniform_delay_ns (int b);
+
+extern void uniform_delay (int b);
 
 extern char *get_receiver_port(unsigned int receiver_id);
+
+extern int spsc_init (struct spsc_ring *ring, unsigned int capacity, unsigned int entry_size);
+
+extern int spsc_push (struct spsc_ring *ring, const void *entry);
+
+extern int spsc_pop (struct spsc_ring *ring, void *entry);
+
+extern uint64_t now_ns (void);
+
+extern void tb_init (struct token_bucket *tb, double rate, double burst, int byte_mode);
+
+extern void tb_refill (struct token_bucket *tb, uint64_t now);
+
+extern int tb_ready (struct token_bucket *tb);
+
+extern void tb_consume (struct token_bucket *tb, unsigned int pkt_len);
+
+extern int tw_init (struct timer_wheel *tw, unsigned int n_slots, uint64_t tick_ns, unsigned int n_timers, uint64_t now);
+
+extern void tw_arm (struct timer_wheel *tw, unsigned int id, uint64_t deadline_ns);
+
+extern void tw_cancel (struct timer_wheel *tw, unsigned int id);
+
+extern int tw_expire (struct timer_wheel *tw, uint64_t now);
+
+extern int ack_build (struct ack_payload *ack, struct seq_window *w, uint64_t echo_ns, uint64_t ack_delay_ns);
+
+extern int ack_due (int is_new, uint32_t seq, uint32_t prev_base, uint32_t new_base, unsigned int unacked, unsigned int ack_every);
+
+extern int ack_valid (struct ack_payload *ack, int len);
+
+extern int seqw_init (struct seq_window *w, unsigned int capacity);
+
+extern int seqw_test (struct seq_window *w, uint32_t seq);
+
+extern int seqw_set (struct seq_window *w, uint32_t seq);
+
+extern unsigned int seqw_advance (struct seq_window *w);
+
+extern void seqw_ack_upto (struct seq_window *w, uint32_t seq);
+
+extern void seqw_sack (struct seq_window *w, unsigned char *sack, unsigned int n_bits);
+
+extern int aqm_init (struct aqm *aqm, const char *name, unsigned int max_q_size);
+
+extern const char *aqm_name (struct aqm *aqm);
+
+extern int aqm_enqueue (struct aqm *aqm, unsigned int slot, struct router_q *q, unsigned int max_q_size, struct pkt_pool *pool, uint64_t now);
+
+extern int aqm_dequeue (struct aqm *aqm, struct router_q *q, struct pkt_pool *pool, uint64_t now);
+
+extern struct queue_metrics *metrics_alloc (unsigned int q_amount);
+
+extern void metrics_enqueue (struct queue_metrics *m, unsigned int depth);
+
+extern void metrics_drop (struct queue_metrics *m, unsigned long n_pkts);
+
+extern void metrics_forward (struct queue_metrics *m, uint64_t sojourn_ns, unsigned int depth, unsigned int len);
+
+extern int metrics_start_exporter (const char *port, struct queue_metrics *metrics, unsigned int q_amount);
+
+extern int sched_init (struct scheduler *sched, const char *name, unsigned int q_amount, unsigned int quantum, struct pkt_pool *pool);
+
+extern void sched_charge (struct scheduler *sched, unsigned int q_index, unsigned int len);
+
+extern void msg_stamp (struct msg_payload *msg, uint64_t ns);
+
+extern uint64_t msg_timestamp_ns (struct msg_payload *msg);
+
+extern void msg_set_len (struct msg_payload *msg, unsigned int payload_len);
+
+extern unsigned int msg_len (struct msg_payload *msg);
+
+extern int msg_parse_payload (const char *arg);
+
+extern int msg_valid (struct msg_payload *msg, int len);
+
+extern uint64_t elapsed_ns (uint64_t since, uint64_t now);
+
+extern void hist_init (struct latency_hist *h);
+
+extern void hist_record (struct latency_hist *h, uint64_t value);
+
+extern void hist_merge (struct latency_hist *dst, struct latency_hist *src);
+
+extern double hist_mean (struct latency_hist *h);
+
+extern uint64_t hist_percentile (struct latency_hist *h, double percentile);
+
+extern void hist_print (struct latency_hist *h, const char *label, const char *unit);
+
+extern int trace_open (const char *path);
+
+extern void trace_event (int event, uint32_t sender_id, uint32_t receiver_id, uint32_t seq, unsigned int size, uint64_t ts_ns);
+
+extern void trace_msg (int event, struct msg_payload *msg, uint64_t ts_ns);
+
+extern void trace_close (void);
+
+extern const char *trace_event_name (int event);
+
+extern int cc_init (struct cong_ctrl *cc, const char *name, unsigned int init_cwnd, unsigned int min_cwnd, unsigned int max_cwnd);
+
+extern void cc_on_ack (struct cong_ctrl *cc, unsigned int acked, uint64_t rtt_ns, uint64_t now);
+
+extern void cc_on_loss (struct cong_ctrl *cc, uint64_t now);
+
+extern void cc_on_timeout (struct cong_ctrl *cc, uint64_t now);
+
+extern unsigned int cc_window (struct cong_ctrl *cc);
+
+extern double avg_round_trip_time (double avg_so_far, double curr_rtt, double b);
+
+extern double avg_deviation (double dev_so_far, double curr_rtt, double exp_avg, double b);
+
+extern double timeout (double exp_avg_rtt, double deviation);
+
+extern int gbn_init (struct gbn_state *gbn);
+
+extern void gbn_sent (struct gbn_state *gbn, unsigned int seq, uint64_t now);
+
+extern int gbn_on_ack (struct gbn_state *gbn, struct cong_ctrl *cc, unsigned int ack_seq, unsigned int *beg_seq_no, unsigned int *next_seq_no, uint64_t rtt_ns, uint64_t now);
+
+extern int gbn_on_timeout (struct gbn_state *gbn, struct cong_ctrl *cc, unsigned int beg_seq_no, unsigned int *next_seq_no, uint64_t timeout_ns, uint64_t now);
+
+extern uint64_t gbn_deadline (struct gbn_state *gbn, unsigned int beg_seq_no, uint64_t timeout_ns);
+
+extern int sr_init (struct sr_state *sr, unsigned int max_window, uint64_t now);
+
+extern void sr_arm (struct sr_state *sr, unsigned int seq, uint64_t rto_ns, int resend, uint64_t now);
+
+extern unsigned int sr_on_ack (struct sr_state *sr, unsigned int ack_seq, unsigned char *sack, unsigned int next_seq_no);
 #endif
\ No newline at end of file
@@ -0,0 +1,366 @@
+// EE122 Project 2 - loadgen.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// loadgen.c is a load generator that runs many simulated senders (flows) in a
+// single event loop. Every flow has its own sequence numbers, arrival process
+// and receiver. The flows are kept in a min-heap ordered by their next send
+// time, and the packets that are due together go out with one sendmmsg().
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+#include "common.h"
+
+#define ARRIVAL_POISSON 0 //exponential gaps with the given mean
+#define ARRIVAL_CONSTANT 1 //every gap equal to the mean
+#define ARRIVAL_ONOFF 2 //Poisson while on, silent for ONOFF_OFF_SEC, like Sender 1
+#define ONOFF_OFF_SEC 5
+#define DEFAULT_ON_SEC 1
+#define DEFAULT_DURATION_SEC 10
+#define MAX_FLOW_SPECS 64
+#define SEND_BATCH 64 //packets handed to the kernel per sendmmsg()
+
+//Input Arguments to loadgen.c:
+//argv[1] is the router IP
+//Optional flags:
+//-f count:arrival:mean_ms:receiver_id adds count flows sending to receiver_id,
+// arrival is poisson, constant or onoff and mean_ms the mean inter-packet time
+// in milliseconds. May be repeated; the default is -f 100:poisson:100:1.
+//-d duration sends for duration seconds (default 10)
+//-o on_sec is the on period of onoff flows (default 1), the off period is 5 s
+//-i first_id is the sender ID of the first flow, the others follow (default 1)
+//-s seed makes the arrival times reproducible (default taken from the clock)
+//-l bytes is the payload size of every packet, from 0 up to MSG_MAX_PAYLOAD
+// (default DEFAULT_MSG_PAYLOAD)
+//-c trace_file records every packet sent in a binary trace (see trace.c)
+
+//One group of identical flows from a -f option
+struct flow_spec {
+    unsigned int count;
+    int arrival;
+    double mean_ms;
+    unsigned int receiver_id;
+};
+
+//One simulated sender
+struct flow {
+    struct pacer pacer; //next send time and the flow's own random generator
+    int arrival;
+    uint32_t sender_id, receiver_id;
+    uint32_t seq;
+    uint64_t on_end_ns; //onoff flows: end of the current on period
+    unsigned long sent;
+};
+
+volatile sig_atomic_t loadgen_running = 1;
+
+//SIGINT/SIGTERM handler, stops the send loop so the flow statistics get printed
+void loadgen_stop(int signum) {
+    loadgen_running = 0;
+}
+
+//Parse count:arrival:mean_ms:receiver_id. Returns 0 on success, -1 if malformed.
+int parse_flow_spec(const char *arg, struct flow_spec *spec) {
+    char arrival[16];
+
+    if (sscanf(arg, "%u:%15[^:]:%lf:%u", &spec->count, arrival, &spec->mean_ms, &spec->receiver_id) != 4
+        || spec->count == 0 || spec->mean_ms <= 0) {
+        return -1;
+    }
+    if (strcmp(arrival, "poisson") == 0) {
+        spec->arrival = ARRIVAL_POISSON;
+    } else if (strcmp(arrival, "constant") == 0) {
+        spec->arrival = ARRIVAL_CONSTANT;
+    } else if (strcmp(arrival, "onoff") == 0) {
+        spec->arrival = ARRIVAL_ONOFF;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+const char *arrival_name(int arrival) {
+    switch (arrival) {
+        case ARRIVAL_CONSTANT:
+            return "constant";
+        case ARRIVAL_ONOFF:
+            return "onoff";
+        default:
+            return "poisson";
+    }
+}
+
+//Schedule the flow's next packet after the one just sent at now
+void flow_advance(struct flow *f, uint64_t now, uint64_t on_ns) {
+    if (f->arrival == ARRIVAL_CONSTANT) {
+        if (now > f->pacer.next_ns + PACER_MAX_BURST * f->pacer.mean_ns) {
+            f->pacer.next_ns = now;
+        }
+        f->pacer.next_ns += (uint64_t)f->pacer.mean_ns;
+        return;
+    }
+    pacer_advance(&f->pacer, now);
+    if (f->arrival == ARRIVAL_ONOFF && f->pacer.next_ns >= f->on_end_ns) {
+        //sleep through the off period, the next on period starts with a packet
+        f->pacer.next_ns = f->on_end_ns + ONOFF_OFF_SEC * ONE_BILLION;
+        f->on_end_ns = f->pacer.next_ns + on_ns;
+    }
+}
+
+//Min-heap of flow indices ordered by next send time
+void heap_sift_up(unsigned int *heap, struct flow *flows, unsigned int i) {
+    unsigned int parent, tmp;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (flows[heap[parent]].pacer.next_ns <= flows[heap[i]].pacer.next_ns) {
+            break;
+        }
+        tmp = heap[parent];
+        heap[parent] = heap[i];
+        heap[i] = tmp;
+        i = parent;
+    }
+}
+
+void heap_sift_down(unsigned int *heap, unsigned int n, struct flow *flows, unsigned int i) {
+    unsigned int child, tmp;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && flows[heap[child + 1]].pacer.next_ns < flows[heap[child]].pacer.next_ns) {
+            child++;
+        }
+        if (flows[heap[i]].pacer.next_ns <= flows[heap[child]].pacer.next_ns) {
+            break;
+        }
+        tmp = heap[child];
+        heap[child] = heap[i];
+        heap[i] = tmp;
+        i = child;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    //Variables used for input arguments
+    char *dest_ip;
+    struct flow_spec specs[MAX_FLOW_SPECS];
+    unsigned int n_specs = 0;
+    unsigned int duration = DEFAULT_DURATION_SEC, on_sec = DEFAULT_ON_SEC;
+    unsigned int first_id = 1;
+    uint64_t seed = 0;
+    int opt, seeded = 0;
+    int payload_len = DEFAULT_MSG_PAYLOAD;
+
+    //Variables used for establishing the connection
+    int sockfd;
+    struct addrinfo hints, *receiver_info;
+
+    //Variables used for the flows
+    struct flow *flows, *f;
+    unsigned int *heap;
+    unsigned int n_flows = 0, i, j;
+    uint64_t start_time, end_time, curr_time, on_ns, cycle_ns, phase;
+    struct timespec wake;
+
+    //Variables used for outgoing packets
+    struct msg_payload batch[SEND_BATCH];
+    struct mmsghdr msgs[SEND_BATCH];
+    struct iovec iovecs[SEND_BATCH];
+    unsigned int batch_flow[SEND_BATCH]; //index in flows of every batch entry
+    unsigned int n_pkts;
+    int sent, k;
+    char *trace_path = NULL;
+    unsigned long total_sent = 0, send_errors = 0;
+
+    //Parsing optional flags, then the input arguments
+    while ((opt = getopt(argc, argv, "f:d:o:i:s:l:c:")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (n_specs == MAX_FLOW_SPECS || parse_flow_spec(optarg, &specs[n_specs]) == -1) {
+                    fprintf(stderr, "Loadgen: bad flow spec %s, expected count:poisson|constant|onoff:mean_ms:receiver_id\n", optarg);
+                    return 1;
+                }
+                n_specs++;
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'o':
+                on_sec = atoi(optarg);
+                break;
+            case 'i':
+                first_id = atoi(optarg);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                seeded = 1;
+                break;
+            case 'l':
+                if ((payload_len = msg_parse_payload(optarg)) == -1) {
+                    fprintf(stderr, "Loadgen: payload size must be between 0 and %lu bytes\n", (unsigned long)MSG_MAX_PAYLOAD);
+                    return 1;
+                }
+                break;
+            case 'c':
+                trace_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-f count:arrival:mean_ms:receiver_id]... [-d duration] [-o on_sec] [-i first_id] [-s seed] [-l payload_bytes] [-c trace_file] router_ip\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        perror("Loadgen: incorrect number of command-line arguments\n");
+        return 1;
+    }
+    dest_ip = argv[optind];
+    if (n_specs == 0) {
+        parse_flow_spec("100:poisson:100:1", &specs[n_specs++]);
+    }
+    if (!seeded) {
+        seed = now_ns() ^ ((uint64_t)getpid() << 32);
+    }
+    for (i = 0; i < n_specs; i++) {
+        n_flows += specs[i].count;
+    }
+
+    //load struct addrinfo with host information
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(dest_ip, ROUTER_PORT, &hints, &receiver_info) != 0) {
+        perror("Loadgen: unable to get target's address info\n");
+        return 2;
+    }
+    if ((sockfd = socket(receiver_info->ai_family, receiver_info->ai_socktype, receiver_info->ai_protocol)) == -1) {
+        perror("Loadgen: unable to create socket\n");
+        return 3;
+    }
+
+    flows = calloc(n_flows, sizeof (struct flow));
+    heap = malloc(n_flows * sizeof (unsigned int));
+    if (flows == NULL || heap == NULL) {
+        perror("Loadgen: unable to allocate the flows\n");
+        return 4;
+    }
+    if (trace_path != NULL && trace_open(trace_path) == -1) {
+        perror("Loadgen: unable to open trace file\n");
+        return 5;
+    }
+    //Every flow gets its own generator seeded from seed and its index, so the
+    //same seed always produces the same aggregate arrival pattern
+    start_time = now_ns();
+    on_ns = (uint64_t)on_sec * ONE_BILLION;
+    cycle_ns = on_ns + ONOFF_OFF_SEC * ONE_BILLION;
+    n_flows = 0;
+    for (i = 0; i < n_specs; i++) {
+        for (j = 0; j < specs[i].count; j++, n_flows++) {
+            f = &flows[n_flows];
+            pacer_init(&f->pacer, specs[i].mean_ms, seed + n_flows);
+            f->arrival = specs[i].arrival;
+            f->sender_id = first_id + n_flows;
+            f->receiver_id = specs[i].receiver_id;
+            //start at a random point of the first gap (or on/off cycle), so
+            //the flows do not all send their first packet at once
+            if (f->arrival == ARRIVAL_ONOFF) {
+                phase = (uint64_t)(xoshiro_uniform(f->pacer.rng) * cycle_ns);
+                if (phase < on_ns) {
+                    f->pacer.next_ns = start_time;
+                    f->on_end_ns = start_time + on_ns - phase;
+                } else {
+                    f->pacer.next_ns = start_time + cycle_ns - phase;
+                    f->on_end_ns = f->pacer.next_ns + on_ns;
+                }
+            } else {
+                f->pacer.next_ns = start_time + (uint64_t)(xoshiro_uniform(f->pacer.rng) * f->pacer.mean_ns);
+            }
+            heap[n_flows] = n_flows;
+            heap_sift_up(heap, flows, n_flows);
+        }
+    }
+
+    //Every batch entry is one packet sent to the router
+    memset(msgs, 0, sizeof msgs);
+    memset(batch, 0, sizeof batch);
+    for (i = 0; i < SEND_BATCH; i++) {
+        msg_set_len(&batch[i], payload_len);
+        iovecs[i].iov_base = &batch[i];
+        iovecs[i].iov_len = msg_len(&batch[i]);
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = receiver_info->ai_addr;
+        msgs[i].msg_hdr.msg_namelen = receiver_info->ai_addrlen;
+    }
+    printf("Loadgen: %u flows to %s for %u sec, %d byte payloads, seed %llu\n", n_flows, dest_ip, duration, payload_len, (unsigned long long)seed);
+    signal(SIGINT, loadgen_stop);
+    signal(SIGTERM, loadgen_stop);
+
+    end_time = start_time + (uint64_t)duration * ONE_BILLION;
+    while (loadgen_running) {
+        curr_time = now_ns();
+        if (curr_time >= end_time) {
+            break;
+        }
+        //Take every flow that is due off the top of the heap
+        n_pkts = 0;
+        while (n_pkts < SEND_BATCH && flows[heap[0]].pacer.next_ns <= curr_time) {
+            f = &flows[heap[0]];
+            batch[n_pkts].seq = htonl(f->seq++);
+            batch[n_pkts].sender_id = htonl(f->sender_id);
+            batch[n_pkts].receiver_id = htonl(f->receiver_id);
+            batch_flow[n_pkts] = heap[0];
+            n_pkts++;
+            flow_advance(f, curr_time, on_ns);
+            heap_sift_down(heap, n_flows, flows, 0);
+        }
+        if (n_pkts > 0) {
+            //Stamp the header version and send time right before sending
+            curr_time = now_ns();
+            for (i = 0; i < n_pkts; i++) {
+                msg_stamp(&batch[i], curr_time);
+            }
+            for (i = 0; i < n_pkts; i += sent) {
+                if ((sent = sendmmsg(sockfd, msgs + i, n_pkts - i, 0)) <= 0) {
+                    send_errors += n_pkts - i;
+                    break;
+                }
+                total_sent += sent;
+                //only the packets the kernel accepted count as sent by their flow
+                for (k = i; k < i + sent; k++) {
+                    flows[batch_flow[k]].sent++;
+                    trace_msg(TRACE_TX, &batch[k], curr_time);
+                }
+            }
+            continue;
+        }
+        //Nothing is due, sleep until the next send time
+        curr_time = flows[heap[0]].pacer.next_ns < end_time ? flows[heap[0]].pacer.next_ns : end_time;
+        wake.tv_sec = curr_time / ONE_BILLION;
+        wake.tv_nsec = curr_time % ONE_BILLION;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+
+    curr_time = now_ns();
+    for (i = 0; i < n_flows; i++) {
+        f = &flows[i];
+        printf("Loadgen stats: flow %u -> receiver %u (%s): sent %lu pkts\n", f->sender_id, f->receiver_id, arrival_name(f->arrival), f->sent);
+    }
+    printf("Loadgen stats: sent %lu pkts (%lu bytes) in %.3f sec (%.1f pkts/sec) | %lu send errors\n",
+           total_sent, total_sent * (unsigned long)iovecs[0].iov_len, elapsed_ns(start_time, curr_time) / (double)ONE_BILLION,
+           total_sent / (elapsed_ns(start_time, curr_time) / (double)ONE_BILLION), send_errors);
+    trace_close();
+    close(sockfd);
+    freeaddrinfo(receiver_info);
+    return 0;
+}
@@ -0,0 +1,158 @@
+// EE122 Project 2 - metrics.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// metrics.c keeps the router's per-queue counters and runs the exporter
+// thread that serves them on a local UDP socket. The counters are updated
+// on the packet path with relaxed atomics and read by the exporter without
+// any locking. Send any datagram to the metrics port (e.g. with
+// "echo | nc -u -w1 127.0.0.1 6001") to get a text snapshot back.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include "common.h"
+
+#define METRICS_DGRAM_MAX 60000 //stay below the largest UDP datagram
+
+//Arguments of the exporter thread
+struct metrics_exporter {
+    int sockfd;
+    struct queue_metrics *metrics;
+    unsigned int q_amount;
+};
+
+//Allocate zeroed, cache-line-aligned counters for q_amount queues
+struct queue_metrics *metrics_alloc (unsigned int q_amount) {
+    struct queue_metrics *metrics;
+
+    if (posix_memalign((void **)&metrics, CACHE_LINE_SIZE, q_amount * sizeof (struct queue_metrics)) != 0) {
+        return NULL;
+    }
+    memset(metrics, 0, q_amount * sizeof (struct queue_metrics));
+    return metrics;
+}
+
+//Count a packet accepted into the queue, depth is the queue length afterwards
+void metrics_enqueue (struct queue_metrics *m, unsigned int depth) {
+    atomic_fetch_add_explicit(&m->enqueued, 1, memory_order_relaxed);
+    atomic_store_explicit(&m->depth, depth, memory_order_relaxed);
+}
+
+//Count packets dropped from the queue (tail drop, AQM, or a full ingress ring)
+void metrics_drop (struct queue_metrics *m, unsigned long n_pkts) {
+    atomic_fetch_add_explicit(&m->dropped, n_pkts, memory_order_relaxed);
+}
+
+//Count a packet of len bytes forwarded after sojourn_ns in the queue, depth is
+//the queue length afterwards
+void metrics_forward (struct queue_metrics *m, uint64_t sojourn_ns, unsigned int depth, unsigned int len) {
+    uint64_t sojourn_us = sojourn_ns / 1000;
+    unsigned int bucket = 0;
+
+    //bucket i holds sojourn times in [2^i, 2^(i+1)) microseconds, bucket 0 also holds 0
+    if (sojourn_us > 0) {
+        bucket = 63 - __builtin_clzll(sojourn_us);
+    }
+    if (bucket >= SOJOURN_BUCKETS) {
+        bucket = SOJOURN_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&m->forwarded, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&m->forwarded_bytes, len, memory_order_relaxed);
+    atomic_fetch_add_explicit(&m->sojourn_hist[bucket], 1, memory_order_relaxed);
+    atomic_store_explicit(&m->depth, depth, memory_order_relaxed);
+}
+
+//Write the counters of one queue in text format, returns the number of characters written
+int metrics_format_queue (struct queue_metrics *m, unsigned int q_index, char *buf, size_t len) {
+    int n, i;
+    unsigned long cumulative = 0;
+
+    n = snprintf(buf, len,
+                 "router_queue_enqueued{queue=\"%u\"} %lu\n"
+                 "router_queue_dropped{queue=\"%u\"} %lu\n"
+                 "router_queue_forwarded{queue=\"%u\"} %lu\n"
+                 "router_queue_forwarded_bytes{queue=\"%u\"} %lu\n"
+                 "router_queue_depth{queue=\"%u\"} %lu\n",
+                 q_index + 1, atomic_load_explicit(&m->enqueued, memory_order_relaxed),
+                 q_index + 1, atomic_load_explicit(&m->dropped, memory_order_relaxed),
+                 q_index + 1, atomic_load_explicit(&m->forwarded, memory_order_relaxed),
+                 q_index + 1, atomic_load_explicit(&m->forwarded_bytes, memory_order_relaxed),
+                 q_index + 1, atomic_load_explicit(&m->depth, memory_order_relaxed));
+    //cumulative histogram, le is the upper bound of the bucket in microseconds
+    for (i = 0; i < SOJOURN_BUCKETS && n < (int)len; i++) {
+        cumulative += atomic_load_explicit(&m->sojourn_hist[i], memory_order_relaxed);
+        n += snprintf(buf + n, len - n, "router_queue_sojourn_us_bucket{queue=\"%u\",le=\"%llu\"} %lu\n",
+                      q_index + 1, (i == SOJOURN_BUCKETS - 1) ? ~0ULL : (2ULL << i), cumulative);
+    }
+    return n;
+}
+
+//Exporter thread: answer every datagram with a snapshot of all counters. Large
+//snapshots are split into several datagrams, each ending on a queue boundary.
+void *metrics_main (void *arg) {
+    struct metrics_exporter *exp = arg;
+    struct sockaddr_storage their_addr;
+    socklen_t addr_len;
+    char request[64];
+    char *buf;
+    int len, q_len;
+    unsigned int i;
+
+    buf = malloc(METRICS_DGRAM_MAX);
+    while (1) {
+        addr_len = sizeof their_addr;
+        if (recvfrom(exp->sockfd, request, sizeof request, 0, (struct sockaddr *)&their_addr, &addr_len) < 0) {
+            continue;
+        }
+        len = 0;
+        for (i = 0; i < exp->q_amount; i++) {
+            q_len = metrics_format_queue(&exp->metrics[i], i, buf + len, METRICS_DGRAM_MAX - len);
+            if (len + q_len >= METRICS_DGRAM_MAX) {
+                sendto(exp->sockfd, buf, len, 0, (struct sockaddr *)&their_addr, addr_len);
+                len = 0;
+                i--; //format this queue again at the start of the next datagram
+                continue;
+            }
+            len += q_len;
+        }
+        sendto(exp->sockfd, buf, len, 0, (struct sockaddr *)&their_addr, addr_len);
+    }
+    return NULL;
+}
+
+//Start the exporter thread on 127.0.0.1:port. Returns 0 on success, -1 on failure.
+int metrics_start_exporter (const char *port, struct queue_metrics *metrics, unsigned int q_amount) {
+    struct addrinfo hints, *info;
+    struct metrics_exporter *exp;
+    pthread_t tid;
+
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    exp = malloc(sizeof (struct metrics_exporter));
+    if (exp == NULL || getaddrinfo("127.0.0.1", port, &hints, &info) != 0) {
+        return -1;
+    }
+    if ((exp->sockfd = socket(info->ai_family, info->ai_socktype, info->ai_protocol)) == -1) {
+        return -1;
+    }
+    if (bind(exp->sockfd, info->ai_addr, info->ai_addrlen) == -1) {
+        close(exp->sockfd);
+        return -1;
+    }
+    freeaddrinfo(info);
+    exp->metrics = metrics;
+    exp->q_amount = q_amount;
+    if (pthread_create(&tid, NULL, metrics_main, exp) != 0) {
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
@@ -0,0 +1,176 @@
+// EE122 Project 2 - pktring.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// pktring.c is the router's memory-mapped ingress backend. A TPACKET_V3
+// packet socket shares a ring of blocks with the kernel; the kernel fills
+// blocks with every UDP datagram sent to the router port on one interface
+// (e.g. lo, or a veth in a network namespace) and the router walks them in
+// place, parsing the IPv4/UDP headers itself, with no system call per packet.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <net/ethernet.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include "common.h"
+
+#define PKTRING_BLOCK_SIZE (1 << 18) //256 KB per block
+#define PKTRING_BLOCK_CNT 64
+#define PKTRING_FRAME_SIZE 2048 //largest frame slot, a block packs frames tighter
+#define PKTRING_RETIRE_MS 1 //hand a partly filled block to the router after 1 ms
+
+//Classic BPF program accepting unfragmented UDP datagrams sent to port and
+//dropping everything else in the kernel, before it reaches the ring. Offsets
+//are relative to the network header so any link layer works.
+int pktring_attach_filter(int fd, unsigned int port) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9), //IP protocol
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, SKF_NET_OFF + 6), //flags and fragment offset
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x3fff, 4, 0),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, SKF_NET_OFF), //X = IP header length
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, SKF_NET_OFF + 2), //UDP destination port
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog prog;
+
+    prog.len = sizeof code / sizeof code[0];
+    prog.filter = code;
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof prog);
+}
+
+//Open a TPACKET_V3 rx ring on interface ifname for the UDP datagrams sent to
+//port. Needs CAP_NET_RAW. Returns 0 on success, -1 on failure with errno set.
+int pktring_open(struct pkt_ring *ring, const char *ifname, const char *port) {
+    struct tpacket_req3 req;
+    struct sockaddr_ll addr;
+    int version = TPACKET_V3;
+
+    memset(ring, 0, sizeof (struct pkt_ring));
+    ring->port = htons(atoi(port));
+    //ETH_P_IP sockets only see received packets, not copies of the ones sent
+    if ((ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP))) == -1) {
+        return -1;
+    }
+    memset(&req, 0, sizeof req);
+    req.tp_block_size = PKTRING_BLOCK_SIZE;
+    req.tp_block_nr = PKTRING_BLOCK_CNT;
+    req.tp_frame_size = PKTRING_FRAME_SIZE;
+    req.tp_frame_nr = PKTRING_BLOCK_SIZE / PKTRING_FRAME_SIZE * PKTRING_BLOCK_CNT;
+    req.tp_retire_blk_tov = PKTRING_RETIRE_MS;
+    if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof version) == -1
+        || pktring_attach_filter(ring->fd, ntohs(ring->port)) == -1
+        || setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof req) == -1) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->map_len = (size_t)PKTRING_BLOCK_SIZE * PKTRING_BLOCK_CNT;
+    ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, 0);
+    if (ring->map == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    ring->block_size = PKTRING_BLOCK_SIZE;
+    ring->block_cnt = PKTRING_BLOCK_CNT;
+    memset(&addr, 0, sizeof addr);
+    addr.sll_family = AF_PACKET;
+    addr.sll_protocol = htons(ETH_P_IP);
+    addr.sll_ifindex = if_nametoindex(ifname);
+    if (addr.sll_ifindex == 0 || bind(ring->fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+        munmap(ring->map, ring->map_len);
+        close(ring->fd);
+        return -1;
+    }
+    return 0;
+}
+
+//UDP payload of a frame in the ring, or NULL if the frame is not an
+//unfragmented IPv4/UDP datagram to the ring's port. Sets *len to its length.
+const unsigned char *pktring_parse(struct pkt_ring *ring, struct tpacket3_hdr *frame, unsigned int *len) {
+    const unsigned char *net = (const unsigned char *)frame + frame->tp_net;
+    const struct iphdr *ip = (const struct iphdr *)net;
+    const struct udphdr *udp;
+    unsigned int caplen, ihl, udp_len;
+
+    //bytes captured from the network header on
+    caplen = frame->tp_snaplen - (frame->tp_net - frame->tp_mac);
+    if (caplen < sizeof (struct iphdr) || ip->version != 4 || ip->protocol != IPPROTO_UDP
+        || (ntohs(ip->frag_off) & 0x3fff) != 0) {
+        return NULL;
+    }
+    ihl = ip->ihl * 4;
+    if (ihl < sizeof (struct iphdr) || caplen < ihl + sizeof (struct udphdr)) {
+        return NULL;
+    }
+    udp = (const struct udphdr *)(net + ihl);
+    udp_len = ntohs(udp->len);
+    if (udp->dest != ring->port || udp_len < sizeof (struct udphdr) || ihl + udp_len > caplen) {
+        return NULL;
+    }
+    *len = udp_len - sizeof (struct udphdr);
+    return (const unsigned char *)(udp + 1);
+}
+
+//Next UDP payload waiting in the ring, or NULL if the router has caught up with
+//the kernel. Sets *len to its length. The payload stays valid until the next
+//call, which may give its block back to the kernel.
+const unsigned char *pktring_next(struct pkt_ring *ring, unsigned int *len) {
+    struct tpacket_block_desc *block;
+    const unsigned char *payload;
+
+    while (1) {
+        block = (struct tpacket_block_desc *)(ring->map + (size_t)ring->cur_block * ring->block_size);
+        if (ring->frame == NULL) {
+            //the kernel hands a block over by setting TP_STATUS_USER last
+            if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                return NULL;
+            }
+            ring->frame = (struct tpacket3_hdr *)((unsigned char *)block + block->hdr.bh1.offset_to_first_pkt);
+            ring->frames_left = block->hdr.bh1.num_pkts;
+            ring->rx_blocks++;
+        }
+        while (ring->frames_left > 0) {
+            payload = pktring_parse(ring, ring->frame, len);
+            ring->frames_left--;
+            ring->frame = (struct tpacket3_hdr *)((unsigned char *)ring->frame + ring->frame->tp_next_offset);
+            if (payload != NULL) {
+                return payload;
+            }
+            ring->bad_frames++;
+        }
+        //every frame of the block has been read, give it back to the kernel
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ring->frame = NULL;
+        ring->cur_block = (ring->cur_block + 1) % ring->block_cnt;
+    }
+}
+
+//Packets the kernel dropped because the ring was full, since the last call
+unsigned long pktring_drops(struct pkt_ring *ring) {
+    struct tpacket_stats_v3 stats;
+    socklen_t len = sizeof stats;
+
+    if (getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) == -1) {
+        return 0;
+    }
+    return stats.tp_drops;
+}
+
+void pktring_close(struct pkt_ring *ring) {
+    munmap(ring->map, ring->map_len);
+    close(ring->fd);
+}
@@ -21,10 +21,21 @@
 
 //Input Arguments:
 //agv[1] is the receiver ID
+//Optional flags:
+//-c trace_file records every packet received in a binary trace (see trace.c)
+
+volatile sig_atomic_t receiver_running = 1;
+
+//SIGINT/SIGTERM handler, stops the receive loop so the delay statistics get printed
+void receiver_stop(int signum) {
+    receiver_running = 0;
+}
 
 int main(int argc, char *argv[]) {
     //Variables used for input argument
     unsigned int receiver_id;
+    char *trace_path = NULL;
+    int opt;
     
     //Variables used in establishing socket and connection
     struct addrinfo hints, *dest_info;
@@ -33,20 +44,32 @@ int main(int argc, char *argv[]) {
     //Variables used for receiving incoming packets
     struct msg_payload *buff;
     int recv_success, rcvd_pkt_cnt = 0;
+    unsigned long rcvd_bytes = 0;
     struct sockaddr_storage their_addr;
     socklen_t addr_len; 
     
     //Variables used in calculating delay time
-    struct timeval receival_time; 
-    time_t delta_time = 0;
-    unsigned int avg_pkt_delay = 0;
+    uint64_t receival_time; //monotonic clock in nanoseconds
+    uint64_t delta_time = 0;
+    struct latency_hist pkt_delay;
+    struct sigaction sa;
     
-    //Parsing input argument
-    if (argc != 2) {
+    //Parsing optional flags, then the input argument
+    while ((opt = getopt(argc, argv, "c:")) != -1) {
+        switch (opt) {
+            case 'c':
+                trace_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c trace_file] receiver_id\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1) {
         perror("Receiver: incorrect number of input arguments\n");
         return 1;
     } else {
-        receiver_id = atoi(argv[1]);
+        receiver_id = atoi(argv[optind]);
     }
     
     //Load struct addrinfo with host information
@@ -70,34 +93,47 @@ int main(int argc, char *argv[]) {
         printf("Receiver %d: unable to bind socket to port\n", receiver_id);
         return 4;
     }
+    if (trace_path != NULL && trace_open(trace_path) == -1) {
+        perror("Receiver: unable to open trace file\n");
+        return 5;
+    }
     printf("Receiver %d: waiting to recvfrom...\n", receiver_id);
     
     //Memory allocation for buffering the incoming packets
     buff = malloc(sizeof (struct msg_payload));
     memset(buff, 0, sizeof (struct msg_payload));
 
+    //No SA_RESTART, so a signal interrupts the blocking recvfrom
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = receiver_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    hist_init(&pkt_delay);
+
     addr_len = sizeof their_addr;
-    memset(&receival_time, 0, sizeof (struct timeval));
-    while (1) { 
+    while (receiver_running) { 
         recv_success = recvfrom(sockfd, buff, sizeof (struct msg_payload), 0, (struct sockaddr *)&their_addr, &addr_len);
-        gettimeofday(&receival_time, NULL);
-        if (recv_success > 0) { //destination received a packet
+        receival_time = now_ns();
+        if (recv_success > 0 && msg_valid(buff, recv_success)) { //destination received a packet in a known format
             rcvd_pkt_cnt++;
+            rcvd_bytes += recv_success;
+            trace_msg(TRACE_RX, buff, receival_time);
             printf("Total packets recvfrom by receiver %d so far: %d\n", receiver_id, rcvd_pkt_cnt);
             buff->seq = ntohl(buff->seq);
             buff->sender_id = ntohl(buff->sender_id);
             buff->receiver_id = ntohl(buff->receiver_id);
-            buff->timestamp_sec = ntohl(buff->timestamp_sec);
-            buff->timestamp_usec = ntohl(buff->timestamp_usec);
-            printf("Pkt data: seq#-%d, senderID-%d, receiverID-%d, timestamp_sec-%d, timestamp_usec:%d\n", buff->seq, buff->sender_id, buff->receiver_id, (int)buff->timestamp_sec, (int)buff->timestamp_usec);
-            
-            //Calculating the avg packet propagation/delay time in microsec
-            //printf("Time of packet receival: %d sec, %d microsec\n", (int)receival_time.tv_sec, (int)receival_time.tv_usec);
-            delta_time = abs((receival_time.tv_usec - buff->timestamp_usec) + (receival_time.tv_sec - buff->timestamp_sec) * ONE_MILLION);
+            printf("Pkt data: version-%d, length-%d, seq#-%d, senderID-%d, receiverID-%d, timestamp_ns-%llu\n", buff->version, recv_success, buff->seq, buff->sender_id, buff->receiver_id, (unsigned long long)msg_timestamp_ns(buff));
             
-            avg_pkt_delay = running_avg(rcvd_pkt_cnt, (unsigned int)delta_time);
-            //printf("Delay time for this packet: %d microsec | Average packet delay:%d microsec\n", (int)delta_time, avg_pkt_delay);
+            //Packet propagation/delay time in nanoseconds, 0 if the sender's
+            //monotonic clock is not comparable (sender on another host)
+            delta_time = elapsed_ns(msg_timestamp_ns(buff), receival_time);
+            hist_record(&pkt_delay, delta_time);
+            //printf("Delay time for this packet: %llu nsec\n", (unsigned long long)delta_time);
         }
     }
+    printf("Receiver %d stats: received %d pkts (%lu bytes)\n", receiver_id, rcvd_pkt_cnt, rcvd_bytes);
+    hist_print(&pkt_delay, "Receiver stats: packet delay", "nsec");
+    trace_close();
     close(sockfd);
+    return 0;
 }
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include <signal.h>
 #include <sys/time.h>
 #include <sys/fcntl.h>
+#include <time.h>
 #include <math.h>
 #include "common.h"
 
@@ -23,6 +24,40 @@
 //agv[1] is the receiver ID
 //argv[2] is the sender IP addr that the receiver sends ACKs back to
 //argv[3] is the sliding window size (default should be a size of 32 packets)
+//Optional flags:
+//-k ack_every sends an ACK for every ack_every packets received in order (default 2)
+//-d ack_delay_us sends a pending ACK at the latest ack_delay_us after the first
+// unacknowledged packet arrived (default 2000)
+//-c trace_file records every packet received and every ACK sent in a binary
+// trace (see trace.c)
+//Out-of-order, duplicate and gap-filling packets are always acknowledged at once.
+
+#define DEFAULT_ACK_EVERY 2
+#define DEFAULT_ACK_DELAY_US 2000
+
+volatile sig_atomic_t receiver_running = 1;
+
+//SIGINT/SIGTERM handler, stops the receive loop so the delay statistics get printed
+void receiver_stop(int signum) {
+    receiver_running = 0;
+}
+
+//Send a compact ACK for the receive window, echoing the send timestamp of the
+//newest packet received, which arrived at arrival_ns. The ACK is traced as from
+//receiver_id to sender_id. Returns the sendto result.
+int send_ack(int ack_sockfd, struct addrinfo *sender_info, struct seq_window *window, uint64_t echo_ns, uint64_t arrival_ns,
+             unsigned int sender_id, unsigned int receiver_id) {
+    struct ack_payload ack;
+    uint64_t now = now_ns();
+    int len, sent;
+
+    len = ack_build(&ack, window, echo_ns, elapsed_ns(arrival_ns, now));
+    sent = sendto(ack_sockfd, &ack, len, 0, sender_info->ai_addr, sender_info->ai_addrlen);
+    if (sent > 0) {
+        trace_event(TRACE_ACK, sender_id, receiver_id, ntohl(ack.cum_ack), len, now);
+    }
+    return sent;
+}
 
 int main(int argc, char *argv[]) {
     //Variables used for input argument
@@ -37,32 +72,69 @@ int main(int argc, char *argv[]) {
     //Variables used for receiving incoming packets + outgoing pkts
     struct msg_payload *buff;
     int recv_success, sent_pkt_success, rcvd_pkt_cnt = 0;
+    unsigned long rcvd_bytes = 0;
     struct sockaddr_storage their_addr;
     socklen_t addr_len; 
     
     //Variables used in calculating delay time
-    struct timeval receival_time; 
-    time_t delta_time = 0;
-    unsigned int avg_pkt_delay = 0;
+    uint64_t receival_time; //monotonic clock in nanoseconds
+    uint64_t delta_time = 0;
+    struct latency_hist pkt_delay;
     
     //Variables used for implementing additional variable delay
     unsigned int b = 0; //Max value in uniform distribution range for delay
-    struct timeval last_delay_time, curr_time;
-    time_t duration = 0;
+    uint64_t last_delay_time, curr_time; //monotonic clock in nanoseconds
+    uint64_t delay_end, wake_time;
+    struct timespec wake;
+    uint64_t duration = 0;
     
     //Variables used for the sliding window Go-Back-N ARQ
-    //bit_map is the number that we will "map" bits onto
-    unsigned int bit_map = 0, next_seq_no = 0;
+    //window holds one bit per sequence number in [next_seq_no, next_seq_no + window size)
+    struct seq_window window;
+    unsigned int next_seq_no = 0, prev_seq_no;
+    int is_new;
+    
+    //Variables used for delayed ACKs
+    unsigned int ack_every = DEFAULT_ACK_EVERY, unacked_cnt = 0;
+    uint64_t ack_delay_ns = DEFAULT_ACK_DELAY_US * 1000ULL;
+    uint64_t first_unacked_time = 0, last_echo_ns = 0, last_arrival_time = 0;
+    unsigned long acks_sent = 0;
+    unsigned int last_sender_id = 0;
+    char *trace_path = NULL;
+    int opt;
     
-    //Parsing input argument
-    if (argc != 4) {
+    //Parsing optional flags, then the input arguments
+    while ((opt = getopt(argc, argv, "k:d:c:")) != -1) {
+        switch (opt) {
+            case 'k':
+                ack_every = atoi(optarg);
+                if (ack_every < 1) {
+                    ack_every = 1;
+                }
+                break;
+            case 'd':
+                ack_delay_ns = strtoull(optarg, NULL, 10) * 1000ULL;
+                break;
+            case 'c':
+                trace_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s receiver_id sender_ip window_size [-k ack_every] [-d ack_delay_us] [-c trace_file]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 3) {
         perror("Receiver: incorrect number of input arguments\n");
         return 1;
     } else {
-        receiver_id = atoi(argv[1]);
-        sender_ip = argv[2];
-        slide_window_size = atoi(argv[3]);
+        receiver_id = atoi(argv[optind]);
+        sender_ip = argv[optind + 1];
+        slide_window_size = atoi(argv[optind + 2]);
         printf("Receiver ID %d, sender IP %s, sliding window size %d\n", receiver_id, sender_ip, slide_window_size);
+        if (slide_window_size < 1 || seqw_init(&window, slide_window_size) == -1) {
+            perror("Receiver: invalid sliding window size\n");
+            return 1;
+        }
     }
     
     //Load struct addrinfo with host information
@@ -107,17 +179,22 @@ int main(int argc, char *argv[]) {
     memset(buff, 0, sizeof (struct msg_payload));
 
     addr_len = sizeof their_addr;
-    memset(&receival_time, 0, sizeof (struct timeval));
-    memset(&last_delay_time, 0, sizeof (struct timeval));
-    memset(&curr_time, 0, sizeof (struct timeval));
     
-    gettimeofday(&last_delay_time, NULL);
-    while (1) {
-        gettimeofday(&curr_time, NULL);
+    if (trace_path != NULL && trace_open(trace_path) == -1) {
+        perror("Receiver: unable to open trace file\n");
+        return 6;
+    }
+    signal(SIGINT, receiver_stop);
+    signal(SIGTERM, receiver_stop);
+    hist_init(&pkt_delay);
+
+    last_delay_time = now_ns();
+    while (receiver_running) {
+        curr_time = now_ns();
         
         //Get the elapsed time in seconds, used for the variable
         //additional delay
-        duration = (curr_time.tv_sec - last_delay_time.tv_sec) + (curr_time.tv_usec - last_delay_time.tv_usec)/ONE_MILLION;
+        duration = elapsed_ns(last_delay_time, curr_time) / ONE_BILLION;
         
         /*Variable packet delay alternates between b=5 and b=15 every 
          5 seconds, where b is part of the uniform distribution
@@ -129,55 +206,84 @@ int main(int argc, char *argv[]) {
             else {
                 b = 15;
             }
-            gettimeofday(&last_delay_time, NULL);
+            last_delay_time = now_ns();
+        }
+        //Additional variable delay prior to packet receival. The wait is cut
+        //short at the delayed ACK deadline, so a held ACK still goes out on time.
+        delay_end = curr_time + uniform_delay_ns(b);
+        while (1) {
+            curr_time = now_ns();
+            //Delayed ACK timer: do not hold an acknowledgement longer than ack_delay_ns
+            if (unacked_cnt > 0 && elapsed_ns(first_unacked_time, curr_time) >= ack_delay_ns) {
+                send_ack(ack_sockfd, sender_info, &window, last_echo_ns, last_arrival_time, last_sender_id, receiver_id);
+                acks_sent++;
+                unacked_cnt = 0;
+            }
+            if (curr_time >= delay_end || !receiver_running) {
+                break;
+            }
+            wake_time = delay_end;
+            if (unacked_cnt > 0 && first_unacked_time + ack_delay_ns < wake_time) {
+                wake_time = first_unacked_time + ack_delay_ns;
+            }
+            wake.tv_sec = wake_time / ONE_BILLION;
+            wake.tv_nsec = wake_time % ONE_BILLION;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
         }
-        //Additional variable delay prior to packet receival
-        uniform_delay(b);
         recv_success = recvfrom(sockfd, buff, sizeof (struct msg_payload), 0, (struct sockaddr *)&their_addr, &addr_len);
-        gettimeofday(&receival_time, NULL);
-        if (recv_success > 0) { //destination received a packet
+        receival_time = now_ns();
+        if (recv_success > 0 && msg_valid(buff, recv_success)) { //destination received a packet in a known format
             rcvd_pkt_cnt++; //increase received packet counter
             //Change data within the packet to host format
+            rcvd_bytes += recv_success;
+            trace_msg(TRACE_RX, buff, receival_time);
             printf("Total packets recvfrom by receiver %d so far: %d\n", receiver_id, rcvd_pkt_cnt);
             buff->seq = ntohl(buff->seq);
             buff->sender_id = ntohl(buff->sender_id);
             buff->receiver_id = ntohl(buff->receiver_id);
-            buff->timestamp_sec = ntohl(buff->timestamp_sec);
-            buff->timestamp_usec = ntohl(buff->timestamp_usec);
-            printf("Pkt data: seq#-%d, senderID-%d, receiverID-%d, timestamp_sec-%d, timestamp_usec:%d\n", buff->seq, buff->sender_id, buff->receiver_id, (int)buff->timestamp_sec, (int)buff->timestamp_usec);
+            last_sender_id = buff->sender_id;
+            printf("Pkt data: version-%d, length-%d, seq#-%d, senderID-%d, receiverID-%d, timestamp_ns-%llu\n", buff->version, recv_success, buff->seq, buff->sender_id, buff->receiver_id, (unsigned long long)msg_timestamp_ns(buff));
             
-            //Calculating the avg packet propagation/delay time in microsec
-            //printf("Time of packet receival: %d sec, %d microsec\n", (int)receival_time.tv_sec, (int)receival_time.tv_usec);
-            delta_time = abs((receival_time.tv_usec - buff->timestamp_usec) + (receival_time.tv_sec - buff->timestamp_sec) * ONE_MILLION);
-            avg_pkt_delay = running_avg(rcvd_pkt_cnt, (unsigned int)delta_time);
-            //printf("Delay time for this packet: %d microsec | Average packet delay:%d microsec\n", (int)delta_time, avg_pkt_delay);
+            //Packet propagation/delay time in nanoseconds, 0 if the sender's
+            //monotonic clock is not comparable (sender on another host)
+            delta_time = elapsed_ns(msg_timestamp_ns(buff), receival_time);
+            hist_record(&pkt_delay, delta_time);
+            //printf("Delay time for this packet: %llu nsec\n", (unsigned long long)delta_time);
             
-            //Keeping track of packets received through 
-            if (buff->seq < (next_seq_no + slide_window_size)) {
-                //update the bit_map
-                bit_map |= (1 << (buff->seq % slide_window_size));
-            }
-            //search through the bit_map to find the next expected packet sequence number
-            while (bit_map & (1 << (next_seq_no % slide_window_size))) {
-                //packet is received, so clear its bit
-                bit_map &= ~(1 <<(next_seq_no % slide_window_size));
-                //Increment the next_seq_no to see if packet has already been received
-                next_seq_no++;
+            //Keeping track of packets received through the window, packets
+            //below next_seq_no are duplicates and must not set a bit
+            is_new = 0;
+            if (buff->seq - next_seq_no < slide_window_size) {
+                is_new = seqw_set(&window, buff->seq) == 1;
             }
+            //Advance to the next expected packet sequence number, past every
+            //packet already received in order
+            prev_seq_no = next_seq_no;
+            seqw_advance(&window);
+            next_seq_no = window.base;
 
-            //Send ACK back to sender with the seq# we expect to receive
-            //Timestamp w/ same timestamp as the original incoming pkt
-            buff->seq = htonl(next_seq_no);
-            buff->sender_id = htonl(buff->sender_id);
-            buff->receiver_id = htonl(buff->receiver_id);
-            buff->timestamp_sec = htonl(buff->timestamp_sec);
-            buff->timestamp_usec = htonl(buff->timestamp_usec);
-            sent_pkt_success = sendto(ack_sockfd, buff, sizeof (struct msg_payload), 0, sender_info->ai_addr, sender_info->ai_addrlen);
-            if (sent_pkt_success <= 0) {
-                printf("cannot send pkt\n");
+            //The ACK echoes the timestamp of the newest packet it acknowledges
+            last_echo_ns = msg_timestamp_ns(buff);
+            last_arrival_time = receival_time;
+            if (unacked_cnt++ == 0) {
+                first_unacked_time = receival_time;
+            }
+            //Send ACK back to sender with the seq# we expect to receive, at once
+            //if the packet was out of order, a duplicate, or filled a gap, and
+            //otherwise only for every ack_every packets
+            if (ack_due(is_new, buff->seq, prev_seq_no, next_seq_no, unacked_cnt, ack_every)) {
+                sent_pkt_success = send_ack(ack_sockfd, sender_info, &window, last_echo_ns, last_arrival_time, last_sender_id, receiver_id);
+                if (sent_pkt_success <= 0) {
+                    printf("cannot send pkt\n");
+                }
+                acks_sent++;
+                unacked_cnt = 0;
             }
         }
     }
+    printf("Receiver %d stats: received %d pkts (%lu bytes) | sent %lu ACKs (%.2f pkts/ACK)\n", receiver_id, rcvd_pkt_cnt, rcvd_bytes, acks_sent, acks_sent ? (double)rcvd_pkt_cnt / acks_sent : 0.0);
+    hist_print(&pkt_delay, "Receiver stats: packet delay", "nsec");
+    trace_close();
     close(sockfd);
     close(ack_sockfd);
     return 0;
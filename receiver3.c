@@ -0,0 +1,501 @@
+// EE122 Project 2 - receiver3.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// receiver3.c terminates many concurrent flows on one host. Several worker
+// threads each bind the receiver port with SO_REUSEPORT, and a classic BPF
+// program steers every datagram to worker sender_id % workers, so a flow always
+// lands on the same worker. Every worker keeps its own hash table of
+// per-(sender, receiver) flow state: reorder window, loss, duplicate and
+// reordering counts, a delay histogram and the delayed-ACK state. Nothing is
+// shared between the workers, so the packet path takes no locks.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <pthread.h>
+#include <linux/filter.h>
+#include "common.h"
+
+//Input Arguments to receiver3.c:
+//argv[1] is the receiver ID, the receiver listens on that receiver's port
+//Optional flags:
+//-w workers is the number of worker threads (default 4)
+//-W window_size is the reorder window of every flow in packets (default 1024).
+// Once a packet arrives beyond the window the oldest missing packets are given
+// up on as lost, so open-loop flows never stall it.
+//-F max_flows is the number of flows every worker can track (default 4096),
+// packets of further flows are counted but not tracked
+//-A sender_ip acknowledges every flow to sender_ip:SENDER_PORT as receiver2 does.
+// Without it no ACKs are sent (open-loop senders such as sender1 and loadgen).
+//-k ack_every sends an ACK for every ack_every packets received in order (default 2)
+//-d ack_delay_us sends a pending ACK at the latest ack_delay_us after the first
+// unacknowledged packet arrived (default 2000)
+//-c trace_file records every packet received and every ACK sent in a binary
+// trace (see trace.c), every worker through its own trace buffer
+//Packets are not printed one by one; the statistics of every flow are printed
+//when the receiver is stopped with SIGINT or SIGTERM.
+
+#define DEFAULT_WORKERS 4
+#define DEFAULT_WINDOW 1024
+#define DEFAULT_MAX_FLOWS 4096
+#define DEFAULT_ACK_EVERY 2
+#define DEFAULT_ACK_DELAY_US 2000
+#define RECV_BATCH 64 //datagrams per recvmmsg
+#define RECV_BUF_BYTES (4 * 1024 * 1024) //socket receive buffer of every worker
+#define FLOW_DELAY_BUCKETS 32
+#define ACK_WHEEL_SLOTS 256
+#define ACK_TICK_NS 100000ULL //delayed ACK timer resolution, 100 usec
+#define WORKER_POLL_NS (100ULL * ONE_MILLION) //recheck receiver_running this often
+
+//State of one (sender, receiver) flow
+struct rx_flow {
+    uint32_t sender_id, receiver_id;
+    int in_use;
+    struct seq_window window; //base is the next sequence number expected
+    uint32_t max_seq; //highest sequence number received
+    unsigned long rcvd, bytes, dups, reordered;
+    uint64_t delay_sum_ns;
+    uint32_t delay_hist[FLOW_DELAY_BUCKETS]; //bucket i: one-way delay in [2^i, 2^(i+1)) usec
+    //Delayed ACK state, as in receiver2
+    unsigned int unacked_cnt;
+    uint64_t last_echo_ns, last_arrival_ns;
+};
+
+//One worker thread with its socket and its flows. The flow table is open
+//addressing with linear probing, allocated once at startup and never more than
+//half full; the delayed-ACK timer of a flow is the one of its table slot.
+struct rx_worker {
+    pthread_t tid;
+    unsigned int index;
+    int sockfd;
+    int ack_sockfd; //-1 if no ACKs are sent
+    struct rx_flow *flows;
+    unsigned int mask; //table capacity - 1, the capacity is a power of 2
+    unsigned int n_flows, max_flows;
+    struct timer_wheel ack_timers;
+    struct latency_hist delay; //one-way delay of every packet this worker received
+    unsigned long rx_pkts, rx_bytes, rx_calls, invalid, untracked, acks_sent;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+volatile sig_atomic_t receiver_running = 1;
+
+//Settings shared read-only by every worker
+unsigned int window_size = DEFAULT_WINDOW;
+unsigned int ack_every = DEFAULT_ACK_EVERY;
+uint64_t ack_delay_ns = DEFAULT_ACK_DELAY_US * 1000ULL;
+struct addrinfo *sender_info = NULL; //where ACKs go, NULL if none are sent
+
+//SIGINT/SIGTERM handler, stops the workers so the flow statistics get printed
+void receiver_stop(int signum) {
+    receiver_running = 0;
+}
+
+//Table slot of the flow (sender_id, receiver_id), which is added if it is new.
+//Returns -1 if the flow is new and the worker already tracks max_flows flows.
+int flow_lookup(struct rx_worker *w, uint32_t sender_id, uint32_t receiver_id) {
+    uint64_t key = ((uint64_t)sender_id << 32) | receiver_id;
+    unsigned int slot = (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 32) & w->mask;
+    struct rx_flow *f;
+
+    while (w->flows[slot].in_use) {
+        f = &w->flows[slot];
+        if (f->sender_id == sender_id && f->receiver_id == receiver_id) {
+            return slot;
+        }
+        slot = (slot + 1) & w->mask;
+    }
+    if (w->n_flows == w->max_flows) {
+        return -1;
+    }
+    f = &w->flows[slot];
+    if (seqw_init(&f->window, window_size) == -1) {
+        return -1;
+    }
+    f->sender_id = sender_id;
+    f->receiver_id = receiver_id;
+    f->in_use = 1;
+    w->n_flows++;
+    return slot;
+}
+
+//Count a one-way delay in the flow's histogram
+void flow_record_delay(struct rx_flow *f, uint64_t delay_ns) {
+    uint64_t delay_us = delay_ns / 1000;
+    unsigned int bucket = 0;
+
+    if (delay_us > 0) {
+        bucket = 63 - __builtin_clzll(delay_us);
+    }
+    if (bucket >= FLOW_DELAY_BUCKETS) {
+        bucket = FLOW_DELAY_BUCKETS - 1;
+    }
+    f->delay_hist[bucket]++;
+    f->delay_sum_ns += delay_ns;
+}
+
+//Upper bound in microseconds of the delay at or below which percentile % of the
+//flow's packets fall
+unsigned long long flow_delay_percentile(struct rx_flow *f, double percentile) {
+    unsigned long seen = 0;
+    unsigned int i;
+
+    for (i = 0; i < FLOW_DELAY_BUCKETS; i++) {
+        seen += f->delay_hist[i];
+        if (seen >= percentile / 100.0 * f->rcvd) {
+            break;
+        }
+    }
+    return 2ULL << (i < FLOW_DELAY_BUCKETS ? i : FLOW_DELAY_BUCKETS - 1);
+}
+
+//Packets the flow never received: every sequence number up to the highest one
+//seen that did not arrive (a packet arriving after the window gave up on it
+//counts as a duplicate)
+unsigned long flow_lost(struct rx_flow *f) {
+    unsigned long unique = f->rcvd - f->dups;
+
+    return (unsigned long)f->max_seq + 1 > unique ? (unsigned long)f->max_seq + 1 - unique : 0;
+}
+
+//Send the flow's pending ACK now
+void flow_send_ack(struct rx_worker *w, struct rx_flow *f, unsigned int slot) {
+    struct ack_payload ack;
+    uint64_t now = now_ns();
+    int len;
+
+    len = ack_build(&ack, &f->window, f->last_echo_ns, elapsed_ns(f->last_arrival_ns, now));
+    if (sendto(w->ack_sockfd, &ack, len, 0, sender_info->ai_addr, sender_info->ai_addrlen) > 0) {
+        w->acks_sent++;
+        trace_event(TRACE_ACK, f->sender_id, f->receiver_id, ntohl(ack.cum_ack), len, now);
+    }
+    f->unacked_cnt = 0;
+    tw_cancel(&w->ack_timers, slot);
+}
+
+//Account for one received datagram of len bytes that arrived at now
+void flow_receive(struct rx_worker *w, struct msg_payload *pkt, int len, uint64_t now) {
+    struct rx_flow *f;
+    uint32_t seq, prev_base;
+    int slot, is_new;
+
+    if (!msg_valid(pkt, len)) {
+        w->invalid++;
+        return;
+    }
+    w->rx_pkts++;
+    w->rx_bytes += len;
+    trace_msg(TRACE_RX, pkt, now);
+    if ((slot = flow_lookup(w, ntohl(pkt->sender_id), ntohl(pkt->receiver_id))) == -1) {
+        w->untracked++;
+        return;
+    }
+    f = &w->flows[slot];
+    seq = ntohl(pkt->seq);
+    f->rcvd++;
+    f->bytes += len;
+    hist_record(&w->delay, elapsed_ns(msg_timestamp_ns(pkt), now));
+    flow_record_delay(f, elapsed_ns(msg_timestamp_ns(pkt), now));
+
+    //Beyond the window: give up on the oldest missing packets to make room
+    if (!SEQ_LT(seq, f->window.base) && seq - f->window.base >= f->window.capacity) {
+        seqw_ack_upto(&f->window, seq - f->window.capacity + 1);
+    }
+    is_new = seqw_set(&f->window, seq) == 1;
+    if (!is_new) {
+        f->dups++;
+    } else if (f->rcvd > 1 && SEQ_LT(seq, f->max_seq)) {
+        f->reordered++;
+    }
+    if (f->rcvd == 1 || SEQ_LT(f->max_seq, seq)) {
+        f->max_seq = seq;
+    }
+    prev_base = f->window.base;
+    seqw_advance(&f->window);
+
+    if (w->ack_sockfd == -1) {
+        return;
+    }
+    //The ACK echoes the timestamp of the newest packet it acknowledges
+    f->last_echo_ns = msg_timestamp_ns(pkt);
+    f->last_arrival_ns = now;
+    if (f->unacked_cnt++ == 0) {
+        tw_arm(&w->ack_timers, slot, now + ack_delay_ns);
+    }
+    //Acknowledge at once a packet that was out of order, a duplicate, or filled
+    //a gap, and otherwise only every ack_every packets
+    if (ack_due(is_new, seq, prev_base, f->window.base, f->unacked_cnt, ack_every)) {
+        flow_send_ack(w, f, slot);
+    }
+}
+
+//Worker thread: receive batches on this worker's socket and update its flows
+void *worker_main(void *arg) {
+    struct rx_worker *w = arg;
+    struct msg_payload *bufs;
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iovs[RECV_BATCH];
+    uint64_t now, deadline;
+    int n_pkts, slot, i;
+
+    bufs = malloc(RECV_BATCH * sizeof (struct msg_payload));
+    if (bufs == NULL) {
+        return NULL;
+    }
+    memset(msgs, 0, sizeof msgs);
+    for (i = 0; i < RECV_BATCH; i++) {
+        iovs[i].iov_base = &bufs[i];
+        iovs[i].iov_len = sizeof (struct msg_payload);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (receiver_running) {
+        now = now_ns();
+        deadline = now + WORKER_POLL_NS;
+        if (w->ack_sockfd != -1) {
+            //Delayed ACK timers that are due
+            while ((slot = tw_expire(&w->ack_timers, now)) != -1) {
+                if (w->flows[slot].unacked_cnt > 0) {
+                    flow_send_ack(w, &w->flows[slot], slot);
+                }
+            }
+            if (w->ack_timers.armed_cnt > 0 && w->ack_timers.cur_tick * ACK_TICK_NS < deadline) {
+                deadline = w->ack_timers.cur_tick * ACK_TICK_NS;
+            }
+        }
+        if (wait_readable(w->sockfd, deadline) <= 0) {
+            continue;
+        }
+        n_pkts = recvmmsg(w->sockfd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+        w->rx_calls++;
+        now = now_ns();
+        for (i = 0; i < n_pkts; i++) {
+            flow_receive(w, &bufs[i], msgs[i].msg_len, now);
+        }
+    }
+    free(bufs);
+    return NULL;
+}
+
+//Steer every datagram of the SO_REUSEPORT group of sockfd to socket
+//sender_id % n_workers, in the order the sockets were bound. The program sees
+//the UDP payload, so offset 0 is the start of struct msg_payload; a datagram
+//too short to hold a sender ID goes to the first socket.
+int attach_shard_filter(int sockfd, unsigned int n_workers) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct msg_payload, sender_id)),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n_workers),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog;
+
+    prog.len = sizeof code / sizeof code[0];
+    prog.filter = code;
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof prog);
+}
+
+//Open one SO_REUSEPORT socket on the receiver port. Returns the socket or -1.
+int open_worker_socket(struct addrinfo *dest_info) {
+    int sockfd, on = 1, rcvbuf = RECV_BUF_BYTES;
+
+    if ((sockfd = socket(dest_info->ai_family, dest_info->ai_socktype, dest_info->ai_protocol)) == -1) {
+        return -1;
+    }
+    //a larger receive buffer absorbs bursts; the kernel may cap it, which is not an error
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) == -1
+        || bind(sockfd, dest_info->ai_addr, dest_info->ai_addrlen) == -1) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+//Set up worker index: its socket, its flow table and its ACK timers.
+//Returns 0 on success, -1 on failure.
+int worker_init(struct rx_worker *w, unsigned int index, unsigned int max_flows, struct addrinfo *dest_info) {
+    unsigned int capacity = 1;
+
+    memset(w, 0, sizeof (struct rx_worker));
+    w->index = index;
+    w->max_flows = max_flows;
+    while (capacity < 2 * max_flows) {
+        capacity <<= 1;
+    }
+    w->mask = capacity - 1;
+    w->flows = calloc(capacity, sizeof (struct rx_flow));
+    hist_init(&w->delay);
+    w->ack_sockfd = -1;
+    if (w->flows == NULL || (w->sockfd = open_worker_socket(dest_info)) == -1) {
+        return -1;
+    }
+    if (sender_info != NULL) {
+        if ((w->ack_sockfd = socket(sender_info->ai_family, sender_info->ai_socktype, sender_info->ai_protocol)) == -1
+            || tw_init(&w->ack_timers, ACK_WHEEL_SLOTS, ACK_TICK_NS, capacity, now_ns()) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    //Variables used for input arguments
+    unsigned int receiver_id;
+    unsigned int n_workers = DEFAULT_WORKERS, max_flows = DEFAULT_MAX_FLOWS;
+    char *sender_ip = NULL;
+    char *trace_path = NULL;
+    int opt;
+
+    //Variables used in establishing the sockets
+    struct addrinfo hints, *dest_info;
+    struct sigaction sa;
+
+    //Variables used for the statistics
+    struct rx_worker *workers, *w;
+    struct rx_flow *f;
+    struct latency_hist delay;
+    unsigned long rx_pkts = 0, rx_bytes = 0, lost = 0, dups = 0, reordered = 0;
+    unsigned long invalid = 0, untracked = 0, acks_sent = 0;
+    unsigned int n_flows = 0, i, j, slot;
+
+    //Parsing optional flags, then the input arguments
+    while ((opt = getopt(argc, argv, "w:W:F:A:k:d:c:")) != -1) {
+        switch (opt) {
+            case 'w':
+                n_workers = atoi(optarg);
+                break;
+            case 'W':
+                window_size = atoi(optarg);
+                break;
+            case 'F':
+                max_flows = atoi(optarg);
+                break;
+            case 'A':
+                sender_ip = optarg;
+                break;
+            case 'k':
+                ack_every = atoi(optarg);
+                if (ack_every < 1) {
+                    ack_every = 1;
+                }
+                break;
+            case 'd':
+                ack_delay_ns = strtoull(optarg, NULL, 10) * 1000ULL;
+                break;
+            case 'c':
+                trace_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-w workers] [-W window_size] [-F max_flows] [-A sender_ip] [-k ack_every] [-d ack_delay_us] [-c trace_file] receiver_id\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 1) {
+        perror("Receiver 3: incorrect number of input arguments\n");
+        return 1;
+    }
+    receiver_id = atoi(argv[optind]);
+    if (n_workers < 1 || window_size < 1 || max_flows < 1) {
+        fprintf(stderr, "Receiver 3: workers, window size and max flows must be positive\n");
+        return 1;
+    }
+
+    //Load struct addrinfo with host information
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(NULL, get_receiver_port(receiver_id), &hints, &dest_info) != 0) {
+        perror("Receiver 3: unable to get address info\n");
+        return 2;
+    }
+    if (sender_ip != NULL && getaddrinfo(sender_ip, SENDER_PORT, &hints, &sender_info) != 0) {
+        perror("Receiver 3: unable to get address info for the sender\n");
+        return 5;
+    }
+
+    //The workers bind in index order, which is the order the shard filter counts in
+    if (posix_memalign((void **)&workers, CACHE_LINE_SIZE, n_workers * sizeof (struct rx_worker)) != 0) {
+        return 3;
+    }
+    for (i = 0; i < n_workers; i++) {
+        if (worker_init(&workers[i], i, max_flows, dest_info) == -1) {
+            perror("Receiver 3: unable to set up worker\n");
+            return 4;
+        }
+    }
+    if (n_workers > 1 && attach_shard_filter(workers[0].sockfd, n_workers) == -1) {
+        perror("Receiver 3: unable to attach the SO_REUSEPORT shard filter\n");
+        return 4;
+    }
+    freeaddrinfo(dest_info);
+    if (trace_path != NULL && trace_open(trace_path) == -1) {
+        perror("Receiver 3: unable to open trace file\n");
+        return 6;
+    }
+
+    //No SA_RESTART, so a signal interrupts a worker waiting for packets
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = receiver_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    printf("Receiver 3: receiver ID %u on port %s, %u workers, window %u pkts, up to %u flows per worker, ACKs %s\n",
+           receiver_id, get_receiver_port(receiver_id), n_workers, window_size, max_flows, sender_ip ? sender_ip : "off");
+    for (i = 0; i < n_workers; i++) {
+        if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+            //the shard filter would keep steering this worker's flows to its socket
+            perror("Receiver 3: unable to start worker thread\n");
+            receiver_running = 0;
+            for (j = 0; j < i; j++) {
+                pthread_join(workers[j].tid, NULL);
+            }
+            trace_close();
+            return 7;
+        }
+    }
+
+    hist_init(&delay);
+    for (i = 0; i < n_workers; i++) {
+        w = &workers[i];
+        pthread_join(w->tid, NULL);
+        close(w->sockfd);
+        for (slot = 0; slot <= w->mask; slot++) {
+            f = &w->flows[slot];
+            if (!f->in_use) {
+                continue;
+            }
+            printf("Receiver 3 stats: flow %u -> %u (worker %u): received %lu pkts (%lu bytes) | lost %lu | duplicates %lu | reordered %lu | delay mean %.1f usec, p50 < %llu usec, p99 < %llu usec\n",
+                   f->sender_id, f->receiver_id, i, f->rcvd, f->bytes, flow_lost(f), f->dups, f->reordered,
+                   f->delay_sum_ns / 1000.0 / f->rcvd, flow_delay_percentile(f, 50.0), flow_delay_percentile(f, 99.0));
+            lost += flow_lost(f);
+            dups += f->dups;
+            reordered += f->reordered;
+        }
+        printf("Receiver 3 stats: worker %u received %lu pkts in %lu recv calls (%.2f pkts/call) | %u flows\n",
+               i, w->rx_pkts, w->rx_calls, w->rx_calls ? (double)w->rx_pkts / w->rx_calls : 0.0, w->n_flows);
+        rx_pkts += w->rx_pkts;
+        rx_bytes += w->rx_bytes;
+        invalid += w->invalid;
+        untracked += w->untracked;
+        acks_sent += w->acks_sent;
+        n_flows += w->n_flows;
+        hist_merge(&delay, &w->delay);
+        if (w->ack_sockfd != -1) {
+            close(w->ack_sockfd);
+        }
+    }
+    printf("Receiver 3 stats: received %lu pkts (%lu bytes) from %u flows | lost %lu | duplicates %lu | reordered %lu | invalid %lu | untracked %lu | sent %lu ACKs\n",
+           rx_pkts, rx_bytes, n_flows, lost, dups, reordered, invalid, untracked, acks_sent);
+    hist_print(&delay, "Receiver 3 stats: packet delay", "nsec");
+    trace_close();
+    return 0;
+}
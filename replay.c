@@ -0,0 +1,271 @@
+// EE122 Project 2 - replay.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// replay.c re-injects a captured packet trace (see trace.c) into the router.
+// It takes the packets that arrived at the router in the trace (or that the
+// senders sent) and sends the same sender ID, receiver ID, sequence number and
+// datagram size to ROUTER_PORT, either with the original inter-arrival times
+// or as fast as possible, so a run can be repeated against another router
+// configuration with exactly the same input.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <time.h>
+#include "common.h"
+
+#define REPLAY_ARRIVAL 0 //TRACE_ENQ and TRACE_DROP records: what reached the router
+#define REPLAY_TX 1 //TRACE_TX records: what the senders sent
+#define DEFAULT_BATCH 64
+#define MAX_BATCH 1024
+#define START_DELAY_NS (10ULL * ONE_MILLION) //lead time before the first timed packet
+
+//Input Arguments to replay.c:
+//argv[1 .. n-1] are trace files, merged into one arrival sequence
+//argv[n] is the router IP
+//Optional flags:
+//-e arrival|tx replays the packets that arrived at the router (default, needs
+// a router trace) or the packets the senders sent (sender or loadgen traces)
+//-f sends as fast as possible instead of with the original timing
+//-x speed scales the original timing, 2 replays twice as fast (default 1)
+//-b batch is the most packets handed to the kernel per sendmmsg() (default 64)
+
+volatile sig_atomic_t replay_running = 1;
+
+//SIGINT/SIGTERM handler, stops the replay so the statistics get printed
+void replay_stop(int signum) {
+    replay_running = 0;
+}
+
+//Order records by timestamp
+int trace_rec_cmp(const void *a, const void *b) {
+    const struct trace_rec *ra = a, *rb = b;
+
+    return ra->ts_ns < rb->ts_ns ? -1 : ra->ts_ns > rb->ts_ns;
+}
+
+//Append the records of trace file path whose event is selected by mode to
+//*recs, which holds *n_recs records and has room for *cap. Returns 0, or -1 if
+//the file cannot be read or is not a trace.
+int load_trace(const char *path, int mode, struct trace_rec **recs, size_t *n_recs, size_t *cap) {
+    struct trace_file_hdr hdr;
+    struct trace_rec rec;
+    FILE *fp;
+    int keep;
+
+    if ((fp = fopen(path, "rb")) == NULL) {
+        perror("Replay: unable to open trace file\n");
+        return -1;
+    }
+    if (fread(&hdr, sizeof hdr, 1, fp) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof hdr.magic) != 0
+        || hdr.version != TRACE_VERSION || hdr.rec_size != sizeof (struct trace_rec)) {
+        fprintf(stderr, "Replay: %s is not a version %d trace file\n", path, TRACE_VERSION);
+        fclose(fp);
+        return -1;
+    }
+    while (fread(&rec, sizeof rec, 1, fp) == 1) {
+        if (mode == REPLAY_TX) {
+            keep = rec.event == TRACE_TX;
+        } else {
+            keep = rec.event == TRACE_ENQ || rec.event == TRACE_DROP;
+        }
+        if (!keep) {
+            continue;
+        }
+        if (*n_recs == *cap) {
+            *cap = *cap ? *cap * 2 : 4096;
+            if ((*recs = realloc(*recs, *cap * sizeof (struct trace_rec))) == NULL) {
+                fclose(fp);
+                return -1;
+            }
+        }
+        (*recs)[(*n_recs)++] = rec;
+    }
+    fclose(fp);
+    return 0;
+}
+
+//Rebuild the datagram of a trace record in pkt
+void build_packet(struct msg_payload *pkt, struct trace_rec *rec) {
+    unsigned int payload_len = rec->size > MSG_HDR_LEN ? rec->size - MSG_HDR_LEN : 0;
+
+    pkt->seq = htonl(rec->seq);
+    pkt->sender_id = htonl(rec->sender_id);
+    pkt->receiver_id = htonl(rec->receiver_id);
+    msg_set_len(pkt, payload_len < MSG_MAX_PAYLOAD ? payload_len : MSG_MAX_PAYLOAD);
+}
+
+int main(int argc, char *argv[]) {
+    //Variables used for input arguments
+    int mode = REPLAY_ARRIVAL, fast = 0, opt;
+    double speed = 1.0;
+    unsigned int batch_size = DEFAULT_BATCH;
+    char *dest_ip;
+
+    //Variables used for establishing the connection
+    int sockfd;
+    struct addrinfo hints, *router_info;
+
+    //Variables used for the trace and the outgoing packets
+    struct trace_rec *recs = NULL;
+    size_t n_recs = 0, cap = 0, next = 0;
+    struct msg_payload *batch;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    unsigned int n_pkts, i, k;
+    int sent;
+    uint64_t start_time, curr_time, due_time = 0, first_ts;
+    unsigned long total_sent = 0, total_bytes = 0, send_errors = 0;
+    struct timespec wake;
+    struct latency_hist lateness; //how far behind its original time every packet went out
+    double elapsed;
+
+    //Parsing optional flags, then the input arguments
+    while ((opt = getopt(argc, argv, "e:fx:b:")) != -1) {
+        switch (opt) {
+            case 'e':
+                if (strcmp(optarg, "arrival") == 0) {
+                    mode = REPLAY_ARRIVAL;
+                } else if (strcmp(optarg, "tx") == 0) {
+                    mode = REPLAY_TX;
+                } else {
+                    fprintf(stderr, "Replay: unknown event selection %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'f':
+                fast = 1;
+                break;
+            case 'x':
+                speed = strtod(optarg, NULL);
+                if (speed <= 0) {
+                    fprintf(stderr, "Replay: speed must be positive\n");
+                    return 1;
+                }
+                break;
+            case 'b':
+                batch_size = atoi(optarg);
+                if (batch_size < 1 || batch_size > MAX_BATCH) {
+                    fprintf(stderr, "Replay: batch size must be between 1 and %d\n", MAX_BATCH);
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-e arrival|tx] [-f] [-x speed] [-b batch_size] trace_file... router_ip\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind < 2) {
+        perror("Replay: incorrect number of command-line arguments\n");
+        return 1;
+    }
+    dest_ip = argv[argc - 1];
+
+    //Merge the selected records of every trace into one time-ordered sequence
+    for (i = optind; i < (unsigned int)argc - 1; i++) {
+        if (load_trace(argv[i], mode, &recs, &n_recs, &cap) == -1) {
+            return 2;
+        }
+    }
+    if (n_recs == 0) {
+        fprintf(stderr, "Replay: no %s records in the trace\n", mode == REPLAY_TX ? "tx" : "enq or drop");
+        return 2;
+    }
+    qsort(recs, n_recs, sizeof (struct trace_rec), trace_rec_cmp);
+    first_ts = recs[0].ts_ns;
+
+    //load struct addrinfo with router information
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(dest_ip, ROUTER_PORT, &hints, &router_info) != 0) {
+        perror("Replay: unable to get router's address info\n");
+        return 3;
+    }
+    if ((sockfd = socket(router_info->ai_family, router_info->ai_socktype, router_info->ai_protocol)) == -1) {
+        perror("Replay: unable to create socket\n");
+        return 3;
+    }
+
+    batch = calloc(batch_size, sizeof (struct msg_payload));
+    msgs = calloc(batch_size, sizeof (struct mmsghdr));
+    iovs = calloc(batch_size, sizeof (struct iovec));
+    if (batch == NULL || msgs == NULL || iovs == NULL) {
+        perror("Replay: unable to allocate the send batch\n");
+        return 4;
+    }
+    for (i = 0; i < batch_size; i++) {
+        iovs[i].iov_base = &batch[i];
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = router_info->ai_addr;
+        msgs[i].msg_hdr.msg_namelen = router_info->ai_addrlen;
+    }
+    printf("Replay: %lu pkts over %.3f sec of trace to %s, %s\n", (unsigned long)n_recs,
+           (recs[n_recs - 1].ts_ns - first_ts) / (double)ONE_BILLION, dest_ip, fast ? "as fast as possible" : "original timing");
+    signal(SIGINT, replay_stop);
+    signal(SIGTERM, replay_stop);
+    hist_init(&lateness);
+
+    start_time = now_ns() + (fast ? 0 : START_DELAY_NS);
+    while (replay_running && next < n_recs) {
+        curr_time = now_ns();
+        //Every packet that is due goes out in this batch
+        n_pkts = 0;
+        while (n_pkts < batch_size && next < n_recs) {
+            due_time = start_time + (uint64_t)((recs[next].ts_ns - first_ts) / speed);
+            if (!fast && due_time > curr_time) {
+                break;
+            }
+            if (!fast) {
+                hist_record(&lateness, curr_time - due_time);
+            }
+            build_packet(&batch[n_pkts], &recs[next]);
+            iovs[n_pkts].iov_len = msg_len(&batch[n_pkts]);
+            n_pkts++;
+            next++;
+        }
+        if (n_pkts > 0) {
+            //Stamp the header version and send time right before sending
+            curr_time = now_ns();
+            for (i = 0; i < n_pkts; i++) {
+                msg_stamp(&batch[i], curr_time);
+            }
+            for (i = 0; i < n_pkts; i += sent) {
+                if ((sent = sendmmsg(sockfd, msgs + i, n_pkts - i, 0)) <= 0) {
+                    send_errors += n_pkts - i;
+                    break;
+                }
+                total_sent += sent;
+                for (k = i; k < i + sent; k++) {
+                    total_bytes += iovs[k].iov_len;
+                }
+            }
+            continue;
+        }
+        //Nothing is due, sleep until the next packet's time
+        wake.tv_sec = due_time / ONE_BILLION;
+        wake.tv_nsec = due_time % ONE_BILLION;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL);
+    }
+
+    elapsed = elapsed_ns(start_time, now_ns()) / (double)ONE_BILLION;
+    printf("Replay stats: sent %lu of %lu pkts (%lu bytes) in %.3f sec (%.1f pkts/sec) | %lu send errors\n",
+           total_sent, (unsigned long)n_recs, total_bytes, elapsed, elapsed > 0 ? total_sent / elapsed : 0.0, send_errors);
+    if (!fast) {
+        hist_print(&lateness, "Replay stats: lateness", "nsec");
+    }
+    close(sockfd);
+    freeaddrinfo(router_info);
+    free(recs);
+    return 0;
+}
@@ -2,11 +2,13 @@
 // Xiaodian (Yinyin) Wang and Arnab Mukherji
 //
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -16,231 +18,1152 @@
 #include <signal.h>
 #include <sys/time.h>
 #include <sys/fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
 #include <math.h>
+#include <linux/filter.h>
 #include "common.h"
 
 #define FLAG_ON 1
 #define FLAG_OFF 0
+#define MAX_EVENTS 8
+#define MAX_BATCH_SIZE 1024
+#define MAX_THREADS 64
+#define SHARD_RING_SIZE 1024 //minimum entries in each ingress -> egress ring
+#define DEFAULT_TICK_US 100 //shaper service tick
 
 //Input Arguments to router.c:
-//argv[1] is the number of queues
+//argv[1] is the number of queues. With more than one queue, packets for receiver
+//  ID i are placed in queue i (queue 1 is the first queue).
 //argv[2] is the router dequeuing interval, or service rate in milliseconds/pkt,
 //  so one packet will be dequeued and sent per dequeuing interval
 //argv[3] is the maximum queue size (in packets). If there are 2 queues, this argument
-//  means that the length of EACH queue = maximum queue size. 
+//  means that the length of EACH queue = maximum queue size.
+//Optional flags (may follow the arguments above):
+//-e runs the event-driven router (epoll + timerfd) instead of the polling loop
+//-b batch_size receives with recvmmsg and sends with sendmmsg, up to batch_size
+//  datagrams per system call (default 1, one recvfrom/sendto per packet)
+//-n num_dest is the number of destinations (receiver IDs 1..num_dest), by default
+//  the number of queues, and at least 2
+//-s scheduler picks the queue to serve: strict (priority to lower queue numbers,
+//  the default), rr (round-robin) or drr (deficit round-robin)
+//-q quantum is the DRR quantum in bytes (default MSG_MAX_LEN, one MTU-sized packet)
+//-t num_threads runs the multi-threaded router: num_threads ingress threads each
+//  bind ROUTER_PORT with SO_REUSEPORT, and every queue is served by its own egress
+//  thread (so with more than one queue each destination link is independent and
+//  the scheduler is not used). Without -t the router is single-threaded.
+//-r pkt_rate replaces the dq_time service with a token bucket shaper releasing
+//  pkt_rate packets/s, or -R byte_rate for a shaper releasing byte_rate bytes/s.
+//  dq_time is ignored when a shaper is used.
+//-B burst is the shaper bucket depth in packets (-r) or bytes (-R), by default
+//  the larger of one MTU-sized packet and 1 ms worth of tokens
+//-a policy[,policy...] sets the active queue management of each queue: none
+//  (tail drop, the default), red or codel. The last policy listed applies to the
+//  remaining queues, so -a codel applies CoDel to every queue.
+//-m port serves the per-queue metrics on 127.0.0.1:port (default METRICS_PORT,
+//  0 turns the exporter off). Any datagram sent to the port gets a text snapshot.
+//-T tick_us is the shaper service tick in microseconds (default 100). Every tick
+//  releases as many packets as the tokens allow.
+//-i ifname receives through a memory-mapped TPACKET_V3 ring on interface ifname
+//  (e.g. lo, or a veth) instead of the UDP socket, without a system call per
+//  packet. Needs CAP_NET_RAW; not available with -t.
 
-int main(int argc, char *argv[]) {
-    //Variables used for input arguments
+//Outgoing packets waiting to be flushed to one destination with sendmmsg
+struct tx_batch {
+    int sockfd;
+    struct addrinfo *dest_info;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    unsigned int *slots; //pool slots of the dequeued packets, freed once they have been sent
+    unsigned int count;
+};
+
+//All of the router state shared by the receive and the service (dequeue) paths
+struct router {
+    //Input arguments
     unsigned int q_amount;
     unsigned int dq_time; // router service rate
     unsigned int max_q_size;
-    
-    //Variables used for establishing connection
-    int listen_sockfd, d1_sockfd, d2_sockfd;
-    struct addrinfo hints, *router_info, *dest1_info, *dest2_info;
-    int return_val, r1_return_val, r2_return_val;
+    unsigned int n_dest;
+    unsigned int n_threads; //ingress threads, 0 for the single-threaded router
+
+    //Token bucket egress shaper, used instead of dq_time when shaped is set
+    int shaped;
+    struct token_bucket shaper;
+    uint64_t tick_ns;
+
+    //Sockets and destination addresses
+    int listen_sockfd;
+    int use_ring; //receive from ring instead of listen_sockfd
+    struct pkt_ring ring;
+    int rx_fd; //becomes readable when packets arrive: listen_sockfd or ring.fd
+    struct tx_batch *dests; //one per destination, receiver ID i is dests[i - 1]
+
+    //Packet pool sized at startup, the queues of pool slots and their scheduler
+    struct pkt_pool pool;
+    struct router_q *queues;
+    struct latency_hist *q_occupancy; //queue length after every dequeue
+    struct aqm *aqms; //AQM policy and drop counters of each queue
+    struct queue_metrics *metrics; //lock-free counters read by the metrics exporter
+    struct scheduler sched;
+
+    //Batched I/O: one pool slot per recvmmsg entry
+    unsigned int batch_size;
+    unsigned int *rx_slots;
+    struct mmsghdr *rx_msgs;
+    struct iovec *rx_iovs;
+
+    //System call statistics, printed when the router exits
+    unsigned long rx_calls, rx_pkts, tx_calls, tx_pkts;
+    unsigned long rx_bytes, tx_bytes; //whole datagrams, header included
+    unsigned long tx_drops; //packets the kernel refused to send (e.g. ENOBUFS)
+
+    //Packet counters
+    unsigned long router_packet_count, packets_sent, unroutable_cnt;
+};
+
+//Multi-threaded router: an ingress thread owns one SO_REUSEPORT socket and
+//feeds every egress thread through its own SPSC ring. It also owns a share of
+//the packet arena: packets are received straight into its slots, only the slot
+//index travels through the rings, and egress threads send from the same slot
+//and hand it back through a return ring.
+struct ingress_thread {
+    pthread_t tid;
+    struct router *rt;
+    unsigned int index;
+    int sockfd;
+    struct pkt_pool pool; //view of this thread's slots of the arena
+    unsigned long rx_pkts, rx_calls, unroutable_cnt;
+    unsigned long *ring_drops; //packets dropped because the ring to an egress thread was full
+};
+
+//An egress thread owns one queue and serves it every dq_time
+struct egress_thread {
+    pthread_t tid;
+    struct router *rt;
+    unsigned int index;
+    int sockfd;
+    int timer_fd; //expires every service interval
+    struct pkt_pool pool; //view of the arena that frees slots to their ingress thread
+    struct router_q q;
+    struct latency_hist occupancy;
+    struct aqm aqm;
+    struct queue_metrics *metrics;
+    struct token_bucket shaper; //each egress link is shaped on its own
+    unsigned long sent, sent_bytes;
+    unsigned long send_drops; //packets the kernel refused to send (e.g. ENOBUFS)
+};
+
+volatile sig_atomic_t router_running = 1;
+
+//SIGINT/SIGTERM handler, stops the service loop so the statistics get printed
+void router_stop(int signum) {
+    router_running = 0;
+}
+
+//Enqueue a packet pool slot that arrived at the router at arrival subject to
+//the queue's AQM policy and count the outcome in the queue's metrics. The trace
+//records the outcome at the arrival time. Returns 0 if the packet was queued.
+int queue_admit(struct aqm *aqm, struct router_q *q, struct pkt_pool *pool, unsigned int max_q_size, struct queue_metrics *m, unsigned int slot,
+                uint64_t arrival) {
+    if (aqm_enqueue(aqm, slot, q, max_q_size, pool, arrival) != 0) {
+        metrics_drop(m, 1);
+        trace_msg(TRACE_DROP, POOL_PKT(pool, slot), arrival);
+        return 1;
+    }
+    metrics_enqueue(m, q->q_size);
+    trace_msg(TRACE_ENQ, POOL_PKT(pool, slot), arrival);
+    return 0;
+}
+
+//AQM drop hook: record a packet CoDel dropped at the head of its queue
+void trace_aqm_drop(struct pkt_pool *pool, unsigned int slot, uint64_t now) {
+    trace_msg(TRACE_DROP, POOL_PKT(pool, slot), now);
+}
+
+//Dequeue the packet to forward from a queue subject to its AQM policy, counting
+//CoDel drops and the sojourn time of the packet. Returns its slot, or -1.
+int queue_release(struct aqm *aqm, struct router_q *q, struct pkt_pool *pool, struct queue_metrics *m) {
+    uint64_t now = now_ns();
+    unsigned long codel_drops = aqm->codel_drops;
+    int slot;
+
+    slot = aqm_dequeue(aqm, q, pool, now);
+    if (aqm->codel_drops != codel_drops) {
+        metrics_drop(m, aqm->codel_drops - codel_drops);
+    }
+    if (slot != -1) {
+        metrics_forward(m, now - pool->enq_ns[slot], q->q_size, msg_len(POOL_PKT(pool, slot)));
+        trace_msg(TRACE_DEQ, POOL_PKT(pool, slot), now);
+    }
+    return slot;
+}
+
+//Place a received packet of len bytes (held in a pool slot) in the queue for its
+//destination. Returns 0 if the packet was queued, otherwise the slot can be reused.
+int router_enqueue(struct router *rt, unsigned int slot, int len) {
+    unsigned int host_recv_id = 0, q_index = 0;
+
+    rt->router_packet_count++;
+    rt->rx_bytes += len;
+    //printf("Total packets recvfrom by router so far: %lu\n", rt->router_packet_count);
+    host_recv_id = ntohl(POOL_PKT(&rt->pool, slot)->receiver_id);
+    if (!msg_valid(POOL_PKT(&rt->pool, slot), len) || host_recv_id < 1 || host_recv_id > rt->n_dest) {
+        //unknown header format, truncated packet, or no route to this receiver
+        rt->unroutable_cnt++;
+        return 1;
+    }
+    if (rt->q_amount > 1) {
+        q_index = host_recv_id - 1;
+        if (q_index >= rt->q_amount) {
+            rt->unroutable_cnt++;
+            return 1;
+        }
+    }
+    return queue_admit(&rt->aqms[q_index], &rt->queues[q_index], &rt->pool, rt->max_q_size, &rt->metrics[q_index], slot, now_ns());
+}
+
+//Receive one packet from the listening socket and enqueue it.
+//Returns the recvfrom() result, so <= 0 means nothing was received.
+int router_receive(struct router *rt) {
+    int packet_success;
     struct sockaddr_storage their_addr;
-    socklen_t addr_len; 
-    
-    //Variables used for incoming/outgoing packets
-    int packet_success, sent_success;
-    struct msg_payload *buff, *received_pkt;
-    int router_packet_count = 0, enq_return = 0, q_index = 0;
-    struct q_elem *node, *dqd_pkt = NULL;
-    struct router_q *q1, *q2;
-    int packets_sent = 0, sent_d1 = 0, sent_d2 = 0;
-    unsigned int host_recv_id = 0;
-    
-    //Variables used for managing router service rate
-    struct timeval last_time;
-    struct timeval curr_time;
-    time_t delta_time = 0; 
+    socklen_t addr_len = sizeof their_addr;
+
+    packet_success = recvfrom(rt->listen_sockfd, POOL_PKT(&rt->pool, rt->rx_slots[0]), sizeof (struct msg_payload), 0, (struct sockaddr *)&their_addr, &addr_len);
+    rt->rx_calls++;
+    if (packet_success > 0) {//router has received a packet
+        rt->rx_pkts++;
+        if (router_enqueue(rt, rt->rx_slots[0], packet_success) == 0) {
+            //the pool is sized so that a queued packet can always be replaced
+            rt->rx_slots[0] = pool_alloc(&rt->pool);
+        }
+    }
+    return packet_success;
+}
+
+//Take up to batch_size packets out of the TPACKET_V3 ring and enqueue them. The
+//payload is copied from the ring into a pool slot, since the ring block has to
+//go back to the kernel long before a queued packet is sent.
+//Returns the number of packets received (0 when the ring is empty).
+int router_receive_ring(struct router *rt) {
+    const unsigned char *payload;
+    unsigned int len;
+    int n_pkts = 0;
+
+    while (n_pkts < (int)rt->batch_size && (payload = pktring_next(&rt->ring, &len)) != NULL) {
+        n_pkts++;
+        rt->rx_pkts++;
+        if (len > sizeof (struct msg_payload)) {
+            rt->router_packet_count++;
+            rt->unroutable_cnt++;
+            continue;
+        }
+        memcpy(POOL_PKT(&rt->pool, rt->rx_slots[0]), payload, len);
+        if (router_enqueue(rt, rt->rx_slots[0], len) == 0) {
+            rt->rx_slots[0] = pool_alloc(&rt->pool);
+        }
+    }
+    return n_pkts;
+}
+
+//Receive up to batch_size packets with a single recvmmsg() and enqueue them.
+//Every entry whose packet was queued gets a fresh pool slot.
+//Returns the number of packets received (<= 0 when the socket is empty).
+int router_receive_batch(struct router *rt) {
+    int n_pkts, i;
+
+    if (rt->use_ring) {
+        return router_receive_ring(rt);
+    }
+    if (rt->batch_size <= 1) {
+        return router_receive(rt);
+    }
+    for (i = 0; i < (int)rt->batch_size; i++) {
+        rt->rx_msgs[i].msg_hdr.msg_namelen = 0;
+    }
+    n_pkts = recvmmsg(rt->listen_sockfd, rt->rx_msgs, rt->batch_size, MSG_DONTWAIT, NULL);
+    rt->rx_calls++;
+    for (i = 0; i < n_pkts; i++) {
+        rt->rx_pkts++;
+        if (router_enqueue(rt, rt->rx_slots[i], rt->rx_msgs[i].msg_len) == 0) {
+            rt->rx_slots[i] = pool_alloc(&rt->pool);
+            rt->rx_iovs[i].iov_base = POOL_PKT(&rt->pool, rt->rx_slots[i]);
+        }
+    }
+    return n_pkts;
+}
+
+//Send every packet waiting in a tx batch with sendmmsg() and free them. A
+//partial send is continued with the rest; packets the kernel refuses are dropped.
+void router_flush(struct router *rt, struct tx_batch *tx) {
+    unsigned int i;
+    int sent;
+
+    if (tx->count == 0) {
+        return;
+    }
+    for (i = 0; i < tx->count; i += sent) {
+        sent = sendmmsg(tx->sockfd, tx->msgs + i, tx->count - i, 0);
+        rt->tx_calls++;
+        if (sent <= 0) {
+            rt->tx_drops += tx->count - i;
+            break;
+        }
+        rt->tx_pkts += sent;
+    }
+    for (i = 0; i < tx->count; i++) {
+        pool_free(&rt->pool, tx->slots[i]);
+    }
+    tx->count = 0;
+}
+
+//Send a dequeued packet through a destination's tx batch. Without batching the
+//packet is sent right away with sendto(), otherwise it waits for router_flush().
+void router_transmit(struct router *rt, struct tx_batch *tx, unsigned int slot) {
+    struct mmsghdr *msg;
+
+    if (rt->batch_size <= 1) {
+        if (sendto(tx->sockfd, POOL_PKT(&rt->pool, slot), msg_len(POOL_PKT(&rt->pool, slot)), 0, tx->dest_info->ai_addr, tx->dest_info->ai_addrlen) == -1) {
+            rt->tx_drops++;
+        } else {
+            rt->tx_pkts++;
+        }
+        rt->tx_calls++;
+        pool_free(&rt->pool, slot);
+        return;
+    }
+    tx->iovs[tx->count].iov_base = POOL_PKT(&rt->pool, slot);
+    tx->iovs[tx->count].iov_len = msg_len(POOL_PKT(&rt->pool, slot));
+    msg = &tx->msgs[tx->count];
+    memset(msg, 0, sizeof *msg);
+    msg->msg_hdr.msg_name = tx->dest_info->ai_addr;
+    msg->msg_hdr.msg_namelen = tx->dest_info->ai_addrlen;
+    msg->msg_hdr.msg_iov = &tx->iovs[tx->count];
+    msg->msg_hdr.msg_iovlen = 1;
+    tx->slots[tx->count++] = slot;
+    if (tx->count == rt->batch_size) {
+        router_flush(rt, tx);
+    }
+}
+
+//Flush the tx batches of every destination
+void router_flush_all(struct router *rt) {
+    unsigned int i;
+
+    for (i = 0; i < rt->n_dest; i++) {
+        router_flush(rt, &rt->dests[i]);
+    }
+}
+
+//Print the size of a packet arena and the pages backing it
+void print_arena(struct pkt_pool *arena) {
+    printf("Router: packet arena of %u slots, %zu KB on %s pages\n", arena->capacity, arena->arena_len / 1024,
+           arena->arena_huge ? "2 MB huge" : "regular");
+}
+
+//Allocate the packet pool and queues, the recvmmsg entries and the per-destination
+//sendmmsg batches. The pool holds every packet that can be in flight at once:
+//full queues, one receive batch and one transmit batch per destination.
+//Returns 0 on success, -1 if memory could not be allocated.
+int router_init_buffers(struct router *rt) {
+    unsigned int i, pool_size;
+
+    pool_size = rt->q_amount * rt->max_q_size + (rt->n_dest + 1) * rt->batch_size;
+    rt->queues = calloc(rt->q_amount, sizeof (struct router_q));
+    rt->q_occupancy = malloc(rt->q_amount * sizeof (struct latency_hist));
+    if (rt->queues == NULL || rt->q_occupancy == NULL || pool_init(&rt->pool, pool_size) == -1) {
+        return -1;
+    }
+    print_arena(&rt->pool);
+    for (i = 0; i < rt->q_amount; i++) {
+        hist_init(&rt->q_occupancy[i]);
+        if (router_q_init(&rt->queues[i], rt->max_q_size) == -1) {
+            return -1;
+        }
+    }
+
+    rt->rx_slots = calloc(rt->batch_size, sizeof (unsigned int));
+    rt->rx_msgs = calloc(rt->batch_size, sizeof (struct mmsghdr));
+    rt->rx_iovs = calloc(rt->batch_size, sizeof (struct iovec));
+    for (i = 0; i < rt->batch_size; i++) {
+        rt->rx_slots[i] = pool_alloc(&rt->pool);
+        rt->rx_iovs[i].iov_base = POOL_PKT(&rt->pool, rt->rx_slots[i]);
+        rt->rx_iovs[i].iov_len = sizeof (struct msg_payload);
+        rt->rx_msgs[i].msg_hdr.msg_iov = &rt->rx_iovs[i];
+        rt->rx_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    for (i = 0; i < rt->n_dest; i++) {
+        rt->dests[i].msgs = calloc(rt->batch_size, sizeof (struct mmsghdr));
+        rt->dests[i].iovs = calloc(rt->batch_size, sizeof (struct iovec));
+        rt->dests[i].slots = calloc(rt->batch_size, sizeof (unsigned int));
+    }
+    return 0;
+}
+
+//Create the datagram sockets for receivers 1..n_dest. The receivers are on the
+//same computer as the router, so localhost information is used.
+//Returns 0 on success, -1 on failure.
+int router_init_dests(struct router *rt, struct addrinfo *hints) {
+    unsigned int i;
+    struct tx_batch *dest;
+
+    rt->dests = calloc(rt->n_dest, sizeof (struct tx_batch));
+    if (rt->dests == NULL) {
+        return -1;
+    }
+    for (i = 0; i < rt->n_dest; i++) {
+        dest = &rt->dests[i];
+        if (getaddrinfo("127.0.0.1", get_receiver_port(i + 1), hints, &dest->dest_info) != 0) {
+            fprintf(stderr, "Router: unable to get address info for Destination %u\n", i + 1);
+            return -1;
+        }
+        if ((dest->sockfd = socket(dest->dest_info->ai_family, dest->dest_info->ai_socktype, dest->dest_info->ai_protocol)) == -1) {
+            fprintf(stderr, "Router: unable to create socket for receiver %u\n", i + 1);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+//Print the drop counters of the AQM policy of queue q_index
+void print_aqm_stats(unsigned int q_index, struct aqm *aqm) {
+    if (aqm->policy == AQM_RED) {
+        printf("Router stats: Q%u AQM red | early drops %lu | forced drops %lu | avg queue %.2f\n",
+               q_index + 1, aqm->red_early_drops, aqm->red_forced_drops, aqm->avg_q);
+    } else if (aqm->policy == AQM_CODEL) {
+        printf("Router stats: Q%u AQM codel | drops %lu\n", q_index + 1, aqm->codel_drops);
+    }
+}
+
+//Print the packet, queue and system call statistics of the router
+void router_print_stats(struct router *rt) {
+    unsigned int i;
+    char label[64];
+
+    printf("Router stats: batch size %u | received %lu pkts in %lu recv calls (%.2f pkts/call) | sent %lu pkts in %lu send calls (%.2f pkts/call)\n",
+           rt->batch_size, rt->rx_pkts, rt->rx_calls, rt->rx_calls ? (double)rt->rx_pkts / rt->rx_calls : 0.0,
+           rt->tx_pkts, rt->tx_calls, rt->tx_calls ? (double)rt->tx_pkts / rt->tx_calls : 0.0);
+    printf("Router stats: received %lu bytes | forwarded %lu bytes (%.1f bytes/pkt)\n",
+           rt->rx_bytes, rt->tx_bytes, rt->packets_sent ? (double)rt->tx_bytes / rt->packets_sent : 0.0);
+    printf("Router stats: scheduler %s | unroutable pkts %lu | send drops %lu\n", rt->sched.name, rt->unroutable_cnt, rt->tx_drops);
+    if (rt->use_ring) {
+        printf("Router stats: rx ring read %lu blocks | skipped %lu frames | kernel ring drops %lu\n",
+               rt->ring.rx_blocks, rt->ring.bad_frames, pktring_drops(&rt->ring));
+    }
+    for (i = 0; i < rt->q_amount; i++) {
+        printf("Router stats: Q%u drop count %u\n", i + 1, rt->queues[i].drop_cnt);
+        snprintf(label, sizeof label, "Router stats: Q%u queue size", i + 1);
+        hist_print(&rt->q_occupancy[i], label, "pkts");
+        print_aqm_stats(i, &rt->aqms[i]);
+    }
+}
+
+//Dequeue one packet from the queue chosen by the scheduler and send it to its destination.
+//Returns the length in bytes of the packet dequeued, 0 if every queue is empty.
+int router_service(struct router *rt) {
+    int q_index, dqd_slot;
+    unsigned int host_recv_id = 0, pkt_len;
+    struct router_q *q;
+
+    //CoDel may drop every packet left in the chosen queue, then pick again
+    do {
+        if ((q_index = rt->sched.pick(&rt->sched, rt->queues)) == -1) {
+            return 0;
+        }
+        q = &rt->queues[q_index];
+        dqd_slot = queue_release(&rt->aqms[q_index], q, &rt->pool, &rt->metrics[q_index]);
+    } while (dqd_slot == -1);
+
+    //Record the queue length distribution
+    hist_record(&rt->q_occupancy[q_index], q->q_size);
+
+    //Packets are only queued once their destination has been checked
+    host_recv_id = ntohl(POOL_PKT(&rt->pool, dqd_slot)->receiver_id);
+    pkt_len = msg_len(POOL_PKT(&rt->pool, dqd_slot));
+    sched_charge(&rt->sched, q_index, pkt_len);
+    router_transmit(rt, &rt->dests[host_recv_id - 1], dqd_slot);
+    rt->packets_sent++;
+    rt->tx_bytes += pkt_len;
+    //printf("Overall total pkts sent by router so far: %lu\n", rt->packets_sent);
+    return pkt_len;
+}
+
+//Shaped service: release as many packets as the token bucket allows right now.
+//Returns the number of packets dequeued.
+int router_service_shaped(struct router *rt) {
+    unsigned int pkt_len;
+    int n_pkts = 0;
+
+    tb_refill(&rt->shaper, now_ns());
+    while (tb_ready(&rt->shaper) && (pkt_len = router_service(rt)) > 0) {
+        tb_consume(&rt->shaper, pkt_len);
+        n_pkts++;
+    }
+    return n_pkts;
+}
+
+//Interval of the service timer in nanoseconds: the shaper tick, or dq_time
+uint64_t service_interval_ns(struct router *rt) {
+    return rt->shaped ? rt->tick_ns : (uint64_t)rt->dq_time * ONE_MILLION;
+}
+
+//Original busy-polling router loop: the listening socket is nonblocking and
+//the elapsed time is checked on every iteration to decide when to dequeue.
+void run_poll_loop(struct router *rt) {
+    uint64_t last_time, delta_time = 0;
     unsigned int sent_flag = 0;
-    
-    //Variables used for obtaining average queue lengths
-    //q_dq_cnt: total number of dequeue operations performed so far
-    //cum_q_size: sum of all queue lengths for every dequeue operation so far
-    unsigned int q_dq_cnt = 0, q1_dq_cnt = 0, q2_dq_cnt = 0;
-    unsigned int cum_q_size = 0, cum_q1_size = 0, cum_q2_size = 0;
-    unsigned int avg_q_size = 0, avg_q1_size = 0, avg_q2_size = 0;
-        
-    //Parsing input arguments
-    if (argc!= 4) {
+
+    last_time = now_ns();
+    while (router_running) {
+        //delta_time is the time elapsed in milliseconds
+        delta_time = elapsed_ns(last_time, now_ns()) / ONE_MILLION;
+
+        router_receive_batch(rt);
+
+        if (rt->shaped) {
+            if (router_service_shaped(rt) > 0) {
+                router_flush_all(rt);
+            }
+            continue;
+        }
+        if ((delta_time >= rt->dq_time) && sent_flag == FLAG_OFF) {
+            router_service(rt);
+            router_flush_all(rt);
+            last_time = now_ns();
+            sent_flag = FLAG_ON;
+        }
+        if (delta_time < rt->dq_time) {
+            sent_flag = FLAG_OFF;
+        }
+    }
+}
+
+//Event-driven router loop. The process sleeps in epoll_wait until either the
+//listening socket is readable or the dq_time service timer (a timerfd on the
+//monotonic clock) fires, so an idle router uses no CPU. Every expiration of the
+//timer dequeues one packet, so expirations missed while draining a burst of
+//ingress are caught up and the service rate stays at one packet per dq_time.
+//A dq_time of 0 serves the queues as fast as packets arrive. With a shaper the
+//timer ticks every tick_ns instead and each tick releases what the tokens allow.
+int run_event_loop(struct router *rt) {
+    int epoll_fd, timer_fd = -1, n_events, i;
+    struct epoll_event ev, events[MAX_EVENTS];
+    struct itimerspec tick;
+    uint64_t expirations;
+
+    if ((epoll_fd = epoll_create1(0)) == -1) {
+        perror("Router: unable to create epoll instance\n");
+        return 1;
+    }
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN;
+    ev.data.fd = rt->rx_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, rt->rx_fd, &ev) == -1) {
+        perror("Router: unable to add listening socket to epoll\n");
+        return 1;
+    }
+
+    if (service_interval_ns(rt) > 0) {
+        if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK)) == -1) {
+            perror("Router: unable to create service timer\n");
+            return 1;
+        }
+        memset(&tick, 0, sizeof tick);
+        tick.it_interval.tv_sec = service_interval_ns(rt) / ONE_BILLION;
+        tick.it_interval.tv_nsec = service_interval_ns(rt) % ONE_BILLION;
+        tick.it_value = tick.it_interval;
+        if (timerfd_settime(timer_fd, 0, &tick, NULL) == -1) {
+            perror("Router: unable to arm service timer\n");
+            return 1;
+        }
+        ev.events = EPOLLIN;
+        ev.data.fd = timer_fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1) {
+            perror("Router: unable to add service timer to epoll\n");
+            return 1;
+        }
+    }
+
+    while (router_running) {
+        n_events = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (n_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("Router: epoll_wait failed\n");
+            return 1;
+        }
+        for (i = 0; i < n_events; i++) {
+            if (events[i].data.fd == rt->rx_fd) {
+                //Drain every datagram that is ready on the nonblocking socket or ring
+                while (router_receive_batch(rt) > 0) {
+                    if (service_interval_ns(rt) == 0) {
+                        while (router_service(rt)) {
+                        }
+                        router_flush_all(rt);
+                    }
+                }
+            } else if (events[i].data.fd == timer_fd) {
+                if (read(timer_fd, &expirations, sizeof expirations) != sizeof expirations) {
+                    continue;
+                }
+                if (rt->shaped) {
+                    router_service_shaped(rt);
+                } else {
+                    while (expirations-- > 0) {
+                        router_service(rt);
+                    }
+                }
+                router_flush_all(rt);
+            }
+        }
+    }
+    close(epoll_fd);
+    if (timer_fd != -1) {
+        close(timer_fd);
+    }
+    return 0;
+}
+
+//Multi-threaded mode: SPSC ring carrying slot indices from ingress thread i to
+//egress thread e is shard_rings[i * q_amount + e], the one returning them from
+//egress thread e to ingress thread i is return_rings[e * n_threads + i]
+struct spsc_ring *shard_rings;
+struct spsc_ring *return_rings;
+struct ingress_thread *ingress;
+struct egress_thread *egress;
+
+//Take back the slots the egress threads have sent or dropped
+void ingress_reclaim(struct ingress_thread *in) {
+    struct router *rt = in->rt;
+    unsigned int e, slot;
+
+    for (e = 0; e < rt->q_amount; e++) {
+        while (spsc_pop(&return_rings[e * rt->n_threads + in->index], &slot) == 0) {
+            in->pool.free_slots[in->pool.free_cnt++] = slot;
+        }
+    }
+}
+
+//Ingress thread: receive packets on this thread's SO_REUSEPORT socket straight
+//into arena slots and push each slot index into the ring of the egress thread
+//that serves its queue. An entry whose packet was passed on gets a fresh slot,
+//the others are received into again.
+void *ingress_main(void *arg) {
+    struct ingress_thread *in = arg;
+    struct router *rt = in->rt;
+    struct msg_payload *pkt;
+    unsigned int *slots;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    unsigned int host_recv_id, q_index, i;
+    int n_pkts;
+    uint64_t now;
+
+    slots = calloc(rt->batch_size, sizeof (unsigned int));
+    msgs = calloc(rt->batch_size, sizeof (struct mmsghdr));
+    iovs = calloc(rt->batch_size, sizeof (struct iovec));
+    for (i = 0; i < rt->batch_size; i++) {
+        slots[i] = pool_alloc(&in->pool);
+        iovs[i].iov_base = POOL_PKT(&in->pool, slots[i]);
+        iovs[i].iov_len = sizeof (struct msg_payload);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (router_running) {
+        //blocks for at most the socket receive timeout, so router_running is rechecked
+        n_pkts = recvmmsg(in->sockfd, msgs, rt->batch_size, MSG_WAITFORONE, NULL);
+        //the arrival time of the batch, carried to the egress thread in enq_ns
+        now = now_ns();
+        in->rx_calls++;
+        if (n_pkts > 0) {
+            ingress_reclaim(in);
+        }
+        for (i = 0; (int)i < n_pkts; i++) {
+            in->rx_pkts++;
+            pkt = POOL_PKT(&in->pool, slots[i]);
+            host_recv_id = ntohl(pkt->receiver_id);
+            q_index = rt->q_amount > 1 ? host_recv_id - 1 : 0;
+            if (!msg_valid(pkt, msgs[i].msg_len) || host_recv_id < 1 || host_recv_id > rt->n_dest || q_index >= rt->q_amount) {
+                in->unroutable_cnt++;
+                continue;
+            }
+            if (spsc_push(&shard_rings[in->index * rt->q_amount + q_index], &slots[i]) == -1) {
+                in->ring_drops[q_index]++;
+                metrics_drop(&rt->metrics[q_index], 1);
+                trace_msg(TRACE_DROP, pkt, now);
+                continue;
+            }
+            in->pool.enq_ns[slots[i]] = now;
+            //the share is sized so that a slot passed on can always be replaced
+            slots[i] = pool_alloc(&in->pool);
+            iovs[i].iov_base = POOL_PKT(&in->pool, slots[i]);
+        }
+    }
+    free(slots);
+    free(msgs);
+    free(iovs);
+    return NULL;
+}
+
+//Move every slot waiting in the rings from the ingress threads into this egress
+//thread's queue. The queue's AQM policy and tail drop apply here, exactly as in
+//router_enqueue(), at the arrival time the ingress thread stored in enq_ns, so
+//sojourn times include the wait in the ring.
+void egress_drain(struct egress_thread *out, unsigned int n_ingress) {
+    struct router *rt = out->rt;
+    unsigned int i, slot;
+
+    for (i = 0; i < n_ingress; i++) {
+        while (spsc_pop(&shard_rings[i * rt->q_amount + out->index], &slot) == 0) {
+            if (queue_admit(&out->aqm, &out->q, &out->pool, rt->max_q_size, out->metrics, slot, out->pool.enq_ns[slot]) != 0) {
+                pool_free(&out->pool, slot);
+            }
+        }
+    }
+}
+
+//Egress thread: the dq_time service discipline for one queue. Every timer
+//expiration drains the ingress rings into the queue and sends one packet,
+//or with a shaper as many packets as this link's token bucket allows.
+void *egress_main(void *arg) {
+    struct egress_thread *out = arg;
+    struct router *rt = out->rt;
+    struct tx_batch *dest;
+    uint64_t expirations;
+    unsigned int host_recv_id, pkt_len;
+    int slot;
+
+    while (router_running) {
+        if (read(out->timer_fd, &expirations, sizeof expirations) != sizeof expirations) {
+            continue;
+        }
+        egress_drain(out, rt->n_threads);
+        if (rt->shaped) {
+            tb_refill(&out->shaper, now_ns());
+        } else if (rt->dq_time == 0) {
+            expirations = out->q.q_size;
+        }
+        while ((rt->shaped ? tb_ready(&out->shaper) : expirations-- > 0) && (slot = queue_release(&out->aqm, &out->q, &out->pool, out->metrics)) != -1) {
+            pkt_len = msg_len(POOL_PKT(&out->pool, slot));
+            if (rt->shaped) {
+                tb_consume(&out->shaper, pkt_len);
+            }
+            hist_record(&out->occupancy, out->q.q_size);
+            host_recv_id = ntohl(POOL_PKT(&out->pool, slot)->receiver_id);
+            dest = &rt->dests[host_recv_id - 1];
+            if (sendto(out->sockfd, POOL_PKT(&out->pool, slot), pkt_len, 0, dest->dest_info->ai_addr, dest->dest_info->ai_addrlen) == -1) {
+                out->send_drops++;
+            } else {
+                out->sent++;
+                out->sent_bytes += pkt_len;
+            }
+            pool_free(&out->pool, slot);
+        }
+    }
+    return NULL;
+}
+
+//Create the timer that paces an egress thread's service discipline. Returns
+//the timerfd, or -1 on failure with errno set.
+int egress_timer(struct router *rt) {
+    struct itimerspec tick;
+    int timer_fd;
+
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, 0)) == -1) {
+        return -1;
+    }
+    memset(&tick, 0, sizeof tick);
+    //a dq_time of 0 serves as fast as possible, polling the rings every 10 usec
+    tick.it_interval.tv_sec = service_interval_ns(rt) / ONE_BILLION;
+    tick.it_interval.tv_nsec = service_interval_ns(rt) > 0 ? service_interval_ns(rt) % ONE_BILLION : 10000;
+    tick.it_value = tick.it_interval;
+    if (timerfd_settime(timer_fd, 0, &tick, NULL) == -1) {
+        close(timer_fd);
+        return -1;
+    }
+    return timer_fd;
+}
+
+//Open one SO_REUSEPORT socket on the router port. The kernel spreads incoming
+//flows across all of the sockets bound this way. Returns the socket or -1.
+int open_reuseport_socket(struct addrinfo *router_info) {
+    int sockfd, on = 1;
+    struct timeval rcv_timeout;
+
+    if ((sockfd = socket(router_info->ai_family, router_info->ai_socktype, router_info->ai_protocol)) == -1) {
+        return -1;
+    }
+    rcv_timeout.tv_sec = 0;
+    rcv_timeout.tv_usec = 100000;
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof on) == -1
+        || setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &rcv_timeout, sizeof rcv_timeout) == -1
+        || bind(sockfd, router_info->ai_addr, router_info->ai_addrlen) == -1) {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+//Stop and join the first n_egress egress and n_ingress ingress threads after a
+//later thread failed to start
+void router_stop_threads(unsigned int n_egress, unsigned int n_ingress) {
+    unsigned int i;
+
+    router_running = 0;
+    for (i = 0; i < n_ingress; i++) {
+        pthread_join(ingress[i].tid, NULL);
+    }
+    for (i = 0; i < n_egress; i++) {
+        pthread_join(egress[i].tid, NULL);
+    }
+}
+
+//Run the multi-threaded router until it is stopped, then print its statistics.
+//Returns 0 on success, non-zero if the threads could not be set up.
+int run_threaded(struct router *rt, struct addrinfo *router_info) {
+    unsigned int i, e, ring_size, share;
+    unsigned long drops, rx_pkts = 0, rx_calls = 0, unroutable = 0;
+    char label[64];
+
+    ingress = calloc(rt->n_threads, sizeof (struct ingress_thread));
+    egress = calloc(rt->q_amount, sizeof (struct egress_thread));
+    shard_rings = calloc(rt->n_threads * rt->q_amount, sizeof (struct spsc_ring));
+    return_rings = calloc(rt->q_amount * rt->n_threads, sizeof (struct spsc_ring));
+    if (ingress == NULL || egress == NULL || shard_rings == NULL || return_rings == NULL) {
+        return 1;
+    }
+    ring_size = rt->max_q_size > SHARD_RING_SIZE ? rt->max_q_size : SHARD_RING_SIZE;
+    for (i = 0; i < rt->n_threads * rt->q_amount; i++) {
+        if (spsc_init(&shard_rings[i], ring_size, sizeof (unsigned int)) == -1) {
+            return 1;
+        }
+    }
+    //Each ingress thread's share of the arena covers every slot it can have out
+    //at once: its receive batch, the packets passed on since it last took slots
+    //back (at most one batch), and full rings, queues and one packet being sent
+    //at every egress thread
+    ring_size = shard_rings[0].mask + 1;
+    share = 2 * rt->batch_size + rt->q_amount * (ring_size + rt->max_q_size + 1);
+    if (pool_init(&rt->pool, rt->n_threads * share) == -1) {
+        return 1;
+    }
+    print_arena(&rt->pool);
+    for (i = 0; i < rt->q_amount * rt->n_threads; i++) {
+        if (spsc_init(&return_rings[i], share, sizeof (unsigned int)) == -1) {
+            return 1;
+        }
+    }
+    for (e = 0; e < rt->q_amount; e++) {
+        egress[e].rt = rt;
+        egress[e].index = e;
+        if ((egress[e].sockfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) {
+            perror("Router: unable to create egress socket\n");
+            return 2;
+        }
+        if ((egress[e].timer_fd = egress_timer(rt)) == -1) {
+            perror("Router: unable to create egress timer\n");
+            return 2;
+        }
+        egress[e].shaper = rt->shaper;
+        egress[e].aqm = rt->aqms[e];
+        egress[e].metrics = &rt->metrics[e];
+        hist_init(&egress[e].occupancy);
+        memset(&egress[e].pool, 0, sizeof (struct pkt_pool));
+        egress[e].pool.pkts = rt->pool.pkts;
+        egress[e].pool.enq_ns = rt->pool.enq_ns;
+        egress[e].pool.owner_rings = &return_rings[e * rt->n_threads];
+        egress[e].pool.slots_per_owner = share;
+        if (router_q_init(&egress[e].q, rt->max_q_size) == -1) {
+            return 1;
+        }
+    }
+    for (i = 0; i < rt->n_threads; i++) {
+        ingress[i].rt = rt;
+        ingress[i].index = i;
+        ingress[i].ring_drops = calloc(rt->q_amount, sizeof (unsigned long));
+        if (pool_init_view(&ingress[i].pool, &rt->pool, i * share, share) == -1) {
+            return 1;
+        }
+        if ((ingress[i].sockfd = open_reuseport_socket(router_info)) == -1) {
+            perror("Router: unable to bind SO_REUSEPORT socket to port\n");
+            return 3;
+        }
+    }
+    printf("Router: running %u ingress threads and %u egress threads\n", rt->n_threads, rt->q_amount);
+    for (e = 0; e < rt->q_amount; e++) {
+        if (pthread_create(&egress[e].tid, NULL, egress_main, &egress[e]) != 0) {
+            perror("Router: unable to start egress thread\n");
+            router_stop_threads(e, 0);
+            return 5;
+        }
+    }
+    for (i = 0; i < rt->n_threads; i++) {
+        if (pthread_create(&ingress[i].tid, NULL, ingress_main, &ingress[i]) != 0) {
+            perror("Router: unable to start ingress thread\n");
+            router_stop_threads(rt->q_amount, i);
+            return 5;
+        }
+    }
+    for (i = 0; i < rt->n_threads; i++) {
+        pthread_join(ingress[i].tid, NULL);
+        close(ingress[i].sockfd);
+        rx_pkts += ingress[i].rx_pkts;
+        rx_calls += ingress[i].rx_calls;
+        unroutable += ingress[i].unroutable_cnt;
+        printf("Router stats: ingress thread %u received %lu pkts\n", i, ingress[i].rx_pkts);
+    }
+    for (e = 0; e < rt->q_amount; e++) {
+        pthread_join(egress[e].tid, NULL);
+        close(egress[e].sockfd);
+        close(egress[e].timer_fd);
+    }
+
+    printf("Router stats: batch size %u | received %lu pkts in %lu recv calls (%.2f pkts/call) | unroutable pkts %lu\n",
+           rt->batch_size, rx_pkts, rx_calls, rx_calls ? (double)rx_pkts / rx_calls : 0.0, unroutable);
+    for (e = 0; e < rt->q_amount; e++) {
+        drops = 0;
+        for (i = 0; i < rt->n_threads; i++) {
+            drops += ingress[i].ring_drops[e];
+        }
+        printf("Router stats: Q%u sent %lu pkts (%lu bytes) | drop count %u | ring drop count %lu | send drops %lu\n",
+               e + 1, egress[e].sent, egress[e].sent_bytes, egress[e].q.drop_cnt, drops, egress[e].send_drops);
+        snprintf(label, sizeof label, "Router stats: Q%u queue size", e + 1);
+        hist_print(&egress[e].occupancy, label, "pkts");
+        print_aqm_stats(e, &egress[e].aqm);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    struct router rt;
+    int event_mode = 0, opt;
+    char *sched_name = "strict";
+    char *metrics_port = METRICS_PORT;
+    char *ring_ifname = NULL;
+    char *trace_path = NULL;
+    char *aqm_list = "none", *aqm_policy, *aqm_next, *saveptr = NULL;
+    unsigned int quantum = 0, i;
+    double shaper_rate = 0, shaper_burst = 0;
+    int byte_mode = 0;
+
+    //Variables used for establishing connection
+    struct addrinfo hints, *router_info;
+    int return_val;
+    struct sock_filter drop_code = BPF_STMT(BPF_RET | BPF_K, 0);
+    struct sock_fprog drop_all = { 1, &drop_code };
+
+    memset(&rt, 0, sizeof rt);
+    //Parsing optional flags, then the input arguments
+    rt.batch_size = 1;
+    rt.tick_ns = DEFAULT_TICK_US * 1000ULL;
+    while ((opt = getopt(argc, argv, "eb:n:s:q:t:r:R:B:T:a:m:i:c:")) != -1) {
+        switch (opt) {
+            case 'e':
+                event_mode = 1;
+                break;
+            case 'b':
+                rt.batch_size = atoi(optarg);
+                if (rt.batch_size < 1 || rt.batch_size > MAX_BATCH_SIZE) {
+                    fprintf(stderr, "Router: batch size must be between 1 and %d\n", MAX_BATCH_SIZE);
+                    return 1;
+                }
+                break;
+            case 'n':
+                rt.n_dest = atoi(optarg);
+                break;
+            case 's':
+                sched_name = optarg;
+                break;
+            case 'q':
+                quantum = atoi(optarg);
+                break;
+            case 't':
+                rt.n_threads = atoi(optarg);
+                if (rt.n_threads < 1 || rt.n_threads > MAX_THREADS) {
+                    fprintf(stderr, "Router: number of threads must be between 1 and %d\n", MAX_THREADS);
+                    return 1;
+                }
+                break;
+            case 'r':
+            case 'R':
+                rt.shaped = 1;
+                byte_mode = (opt == 'R');
+                shaper_rate = strtod(optarg, NULL);
+                break;
+            case 'B':
+                shaper_burst = strtod(optarg, NULL);
+                break;
+            case 'a':
+                aqm_list = optarg;
+                break;
+            case 'm':
+                metrics_port = optarg;
+                break;
+            case 'T':
+                rt.tick_ns = strtoull(optarg, NULL, 10) * 1000ULL;
+                break;
+            case 'i':
+                ring_ifname = optarg;
+                break;
+            case 'c':
+                trace_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s q_amount dq_time max_q_size [-e] [-b batch_size] [-n num_dest] [-s strict|rr|drr] [-q quantum] [-t num_threads] [-r pkt_rate | -R byte_rate] [-B burst] [-T tick_us] [-a none|red|codel[,...]] [-m metrics_port] [-i ifname] [-c trace_file]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 3) {
         perror("Router: incorrect number of command-line arguments\n");
         return 1;
     } else {
-        q_amount = atoi(argv[1]);
-        dq_time = atoi(argv[2]);
-        max_q_size = atoi(argv[3]);
+        rt.q_amount = atoi(argv[optind]);
+        rt.dq_time = atoi(argv[optind + 1]);
+        rt.max_q_size = atoi(argv[optind + 2]);
+    }
+    if (rt.q_amount < 1) {
+        fprintf(stderr, "Router: there must be at least one queue\n");
+        return 1;
+    }
+    if (rt.n_dest == 0) {
+        rt.n_dest = rt.q_amount > 2 ? rt.q_amount : 2;
+    }
+    if (rt.shaped) {
+        if (shaper_rate <= 0 || rt.tick_ns == 0) {
+            fprintf(stderr, "Router: shaper rate and tick must be positive\n");
+            return 1;
+        }
+        //Default burst: one largest packet, or the tokens earned in 1 ms if that is more, so
+        //tokens are not lost when a busy receive path delays a service tick
+        if (shaper_burst <= 0) {
+            shaper_burst = shaper_rate / 1000;
+            if (shaper_burst < (byte_mode ? MSG_MAX_LEN : 1)) {
+                shaper_burst = byte_mode ? MSG_MAX_LEN : 1;
+            }
+        }
+        tb_init(&rt.shaper, shaper_rate, shaper_burst, byte_mode);
+    }
+    //AQM policy of every queue, the last policy listed repeats
+    rt.aqms = calloc(rt.q_amount, sizeof (struct aqm));
+    aqm_policy = strtok_r(aqm_list, ",", &saveptr);
+    for (i = 0; i < rt.q_amount; i++) {
+        if (aqm_policy == NULL || aqm_init(&rt.aqms[i], aqm_policy, rt.max_q_size) == -1) {
+            fprintf(stderr, "Router: unknown AQM policy %s\n", aqm_policy ? aqm_policy : "");
+            return 1;
+        }
+        rt.aqms[i].on_drop = trace_aqm_drop;
+        if ((aqm_next = strtok_r(NULL, ",", &saveptr)) != NULL) {
+            aqm_policy = aqm_next;
+        }
+    }
+    srand(now_ns());
+    if (trace_path != NULL && trace_open(trace_path) == -1) {
+        perror("Router: unable to open trace file\n");
+        return 1;
+    }
+
+    //Lock-free per-queue counters and their exporter thread
+    if ((rt.metrics = metrics_alloc(rt.q_amount)) == NULL) {
+        perror("Router: unable to allocate queue metrics\n");
+        return 1;
     }
-    
+    if (strcmp(metrics_port, "0") != 0 && metrics_start_exporter(metrics_port, rt.metrics, rt.q_amount) == -1) {
+        fprintf(stderr, "Router: unable to serve metrics on port %s, continuing without them\n", metrics_port);
+    }
+    if (sched_init(&rt.sched, sched_name, rt.q_amount, quantum, &rt.pool) == -1) {
+        fprintf(stderr, "Router: unknown scheduler %s\n", sched_name);
+        return 1;
+    }
+
     //load struct addrinfo with router information
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_flags = AI_PASSIVE; 
-    
+    hints.ai_flags = AI_PASSIVE;
+
     //Get address information
     if ((return_val = getaddrinfo(NULL, ROUTER_PORT, &hints, &router_info)) != 0) {
         perror("Router: unable to get address info\n");
         return 1;
     }
-    
+
+    if (rt.n_threads > 0 && ring_ifname != NULL) {
+        fprintf(stderr, "Router: the packet ring (-i) is only available to the single-threaded router\n");
+        return 1;
+    }
+    if (rt.n_threads > 0) {
+        signal(SIGINT, router_stop);
+        signal(SIGTERM, router_stop);
+        if (router_init_dests(&rt, &hints) == -1) {
+            return 4;
+        }
+        return_val = run_threaded(&rt, router_info);
+        trace_close();
+        return return_val;
+    }
+
     //Take fields from first record in router_info, and create socket from it
-    if ((listen_sockfd = socket(router_info->ai_family, router_info->ai_socktype, router_info->ai_protocol)) == -1) {
+    if ((rt.listen_sockfd = socket(router_info->ai_family, router_info->ai_socktype, router_info->ai_protocol)) == -1) {
         perror("Router: unable to create listening socket\n");
         return 2;
     }
     //set listening socket to be nonblocking
-    fcntl(listen_sockfd, F_SETFL, O_NONBLOCK);
-    
-    if((bind(listen_sockfd, router_info->ai_addr, router_info->ai_addrlen)) == -1) {
-        close(listen_sockfd);
+    fcntl(rt.listen_sockfd, F_SETFL, O_NONBLOCK);
+
+    if((bind(rt.listen_sockfd, router_info->ai_addr, router_info->ai_addrlen)) == -1) {
+        close(rt.listen_sockfd);
         perror("Router: unable to bind socket to port\n");
         return 3;
     }
+    rt.rx_fd = rt.listen_sockfd;
+    if (ring_ifname != NULL) {
+        if (pktring_open(&rt.ring, ring_ifname, ROUTER_PORT) == -1) {
+            perror("Router: unable to open packet ring\n");
+            return 3;
+        }
+        //the socket stays bound so the port is not unreachable, but keeps nothing
+        if (setsockopt(rt.listen_sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &drop_all, sizeof drop_all) == -1) {
+            perror("Router: unable to filter listening socket\n");
+            return 3;
+        }
+        rt.use_ring = 1;
+        rt.rx_fd = rt.ring.fd;
+        printf("Router: receiving from a TPACKET_V3 ring on %s\n", ring_ifname);
+    }
     printf("Router: waiting to recvfrom...\n");
-    
-    //Create a datagram socket for Receiver 1
-    //Receiver 1 is on same computer as router, use localhost information
-    if ((r1_return_val = getaddrinfo("127.0.0.1", get_receiver_port(1), &hints, &dest1_info)) != 0) {
-        perror("Router: unable to get address info for Destination 1\n");
+
+    //Create a datagram socket for every destination
+    if (router_init_dests(&rt, &hints) == -1) {
         return 4;
     }
-    
-    if ((d1_sockfd = socket(dest1_info->ai_family, dest1_info->ai_socktype, dest1_info->ai_protocol)) == -1) {
-        close(d1_sockfd);
-        perror("Router: unable to create socket for receiver 1\n");
-    }
-    
-    //Create datagram socket for Receiver 2
-    //Receiver 2 is on same computer as router, use localhost information
-    if((r2_return_val = getaddrinfo("127.0.0.1", get_receiver_port(2), &hints, &dest2_info)) != 0) {
-        perror("Router: unable to get address info for Destination 2\n");
-        return 5;
-    }
-    
-    if ((d2_sockfd = socket(dest2_info->ai_family, dest2_info->ai_socktype, dest2_info->ai_protocol)) == -1) {
-        close(d2_sockfd);
-        perror("Router: unable to create socket for receiver 2\n");
-    }
-    
-    addr_len = sizeof their_addr;
-    last_time.tv_sec = 0;
-    last_time.tv_usec = 0;
-    
-    //Memory allocation of the buffer for the incoming packets, queues, & packet to be queued
-    buff = malloc(sizeof (struct msg_payload));
-    q1 = malloc(sizeof (struct router_q));
-    q2 = malloc(sizeof (struct router_q));
-    node = malloc(sizeof (struct q_elem));
-    
-    memset(buff, 0, sizeof (struct msg_payload));
-    memset(q1, 0, sizeof (struct router_q));
-    memset(q2, 0, sizeof (struct router_q));
-    memset(node, 0, sizeof (struct q_elem));
-    memset(&last_time, 0, sizeof last_time);
-    memset(&curr_time, 0, sizeof curr_time);
-    gettimeofday(&last_time, NULL); 
-     
-    while (1) {
-        gettimeofday(&curr_time, NULL);
-        //delta_time is the time elapsed in milliseconds
-        delta_time =abs(((curr_time.tv_usec + curr_time.tv_sec * ONE_MILLION) - (last_time.tv_usec +last_time.tv_sec * ONE_MILLION))/1000);
-        
-        packet_success = recvfrom(listen_sockfd, buff, sizeof (struct msg_payload), 0, (struct sockaddr *)&their_addr, &addr_len);
-        if (packet_success > 0) {//router has received a packet
-            router_packet_count++;
-            //printf("Total packets recvfrom by router so far: %d\n", router_packet_count);
-            //printf("Delta time is %d\n", (int)delta_time);
-            received_pkt = buff;
-            //received packet becomes buffer within the linked-list node 
-            node->buffer = received_pkt; 
-            if (q_amount == 1) {
-                //enqueue node into linked-list
-                enq_return = enqueue(node, q1, max_q_size);
-            }
-            if (q_amount > 1) {
-                host_recv_id = ntohl(node->buffer->receiver_id);
-                if ((int)host_recv_id == 1) {
-                   enq_return = enqueue(node, q1, max_q_size);
-                }
-                if ((int)host_recv_id == 2) {
-                    enq_return = enqueue(node, q2, max_q_size);
-                }
-            }
-            if (enq_return == 0) {
-                buff = malloc(sizeof (struct msg_payload));
-                node = malloc(sizeof (struct q_elem));
-                memset(buff, 0, sizeof buff);
-                memset(node, 0, sizeof node); 
-            }
-        }
-        
-        if ((delta_time >= dq_time) && sent_flag == FLAG_OFF) {
-            //printf("Delta time: %d, >= dequeue rate for router\n", (int)delta_time);
-            if (q_amount == 1) {
-                dqd_pkt = dequeue(q1);
-                //printf("Packet Sequence number %d\n", dqd_pkt->buffer->seq);
-                //Obtain the average queue length
-                if (q1->q_size != 0) {
-                    q_dq_cnt++;
-                    cum_q_size += q1->q_size;
-                    avg_q_size = running_avg(q_dq_cnt, cum_q_size);
-                    printf("SINGLE QUEUE - Cumulative sum of queue lengths: %d | # of dequeue operations: %d | Average router queue size: %d\n", cum_q_size, q_dq_cnt, avg_q_size);
-                }
-            }
-            if (q_amount == 2) {
-                //The flow (sender1, destination1) is prioritized,
-                //so dequeueing q1 is prioritized. Only dequeued from q2 if q1 is empty.
-                if (q1->q_size > 0) {
-                    dqd_pkt = dequeue(q1);
-                    printf("Dequeued from q1, q1 size is %d\n", q1->q_size);
-                    //Obtain the average queue 1 length
-                    if (q1->q_size != 0) {
-                        cum_q1_size += q1->q_size;
-                        q1_dq_cnt++;
-                        avg_q1_size = running_avg(q1_dq_cnt, cum_q1_size);
-                        printf("QUEUE 1 - Cum. sum of queue lengths: %d | # of dequeue operations: %d | Avg router Q1 size: %d | Avg router Q2 size: %d\n", cum_q1_size, q1_dq_cnt, avg_q1_size, avg_q2_size);
-                    }
-                } else {
-                    dqd_pkt = dequeue(q2);
-                    //printf("Dequeued from q2, q2 size is %d\n", q2->q_size);
-                    //Obtain the average queue 2 length
-                    if (q2->q_size != 0) {
-                        cum_q2_size += q2->q_size;
-                        q2_dq_cnt++; 
-                        avg_q2_size = running_avg(q2_dq_cnt, cum_q2_size);
-                        printf("QUEUE 2 - Cum. sum of queue lengths: %d | # of dequeue operations: %d | Avg router Q1 size: %d | Avg router Q2 size: %d\n", cum_q2_size, q2_dq_cnt, avg_q1_size, avg_q2_size);
-                    }
-                }
-            }
-            if (dqd_pkt != NULL) {
-                host_recv_id = ntohl(dqd_pkt->buffer->receiver_id);
-                if ((int)host_recv_id == 1) {
-                    sent_success = sendto(d1_sockfd, dqd_pkt->buffer, sizeof (struct msg_payload), 0, dest1_info->ai_addr, dest1_info->ai_addrlen);
-                    sent_d1++;
-                    //printf("Pkts sent to dest_1 so far: %d\n", sent_d1);
-                    printf("Drop count %d\n", q1->drop_cnt); 
-                }
-                if ((int)host_recv_id == 2) {
-                   sent_success = sendto(d2_sockfd, dqd_pkt->buffer, sizeof (struct msg_payload), 0, dest2_info->ai_addr, dest2_info->ai_addrlen);
-                    sent_d2++;
-                    //printf("Pkts sent to dest_2 so far: %d\n", sent_d2);
-                }
-                packets_sent++;
-                //printf("Overall total pkts sent by router so far: %d\n", packets_sent);
-                free(dqd_pkt->buffer);
-                free(dqd_pkt);
-            }
-            gettimeofday(&last_time, NULL); 
-            sent_flag = FLAG_ON;
-        }
-        if (delta_time < dq_time) {
-            sent_flag = FLAG_OFF;
-        }
+
+    //Allocation of the packet pool, queues and I/O batches
+    if (router_init_buffers(&rt) == -1) {
+        perror("Router: unable to allocate packet pool and queues\n");
+        return 6;
+    }
+
+    signal(SIGINT, router_stop);
+    signal(SIGTERM, router_stop);
+    printf("Router: %u queues, %u destinations, %s scheduler\n", rt.q_amount, rt.n_dest, rt.sched.name);
+    if (event_mode) {
+        printf("Router: running event-driven (epoll) service loop\n");
+        run_event_loop(&rt);
+    } else {
+        run_poll_loop(&rt);
+    }
+    router_flush_all(&rt);
+    router_print_stats(&rt);
+    trace_close();
+    if (rt.use_ring) {
+        pktring_close(&rt.ring);
+    }
+    close(rt.listen_sockfd);
+    for (i = 0; i < rt.n_dest; i++) {
+        close(rt.dests[i].sockfd);
     }
-    close(listen_sockfd);
-    close(d1_sockfd);
-    close(d2_sockfd);
-}
\ No newline at end of file
+    return 0;
+}
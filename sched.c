@@ -0,0 +1,112 @@
+// EE122 Project 2 - sched.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// sched.c contains the queue schedulers used by the router to decide which
+// queue is served on every dequeue: strict priority, round-robin and
+// deficit round-robin.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "common.h"
+
+//Length in bytes of the packet at the head of a (non-empty) queue
+unsigned int queue_head_len(struct pkt_pool *pool, struct router_q *q) {
+    return msg_len(POOL_PKT(pool, q->slots[q->head]));
+}
+
+//Strict priority: queue 0 has the highest priority, a queue is only served
+//when every queue with a lower index is empty
+int strict_pick(struct scheduler *sched, struct router_q *queues) {
+    unsigned int i;
+
+    for (i = 0; i < sched->q_amount; i++) {
+        if (queues[i].q_size > 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+//Round-robin: one packet from each non-empty queue in turn
+int rr_pick(struct scheduler *sched, struct router_q *queues) {
+    unsigned int i, q_index;
+
+    for (i = 0; i < sched->q_amount; i++) {
+        q_index = (sched->current + i) % sched->q_amount;
+        if (queues[q_index].q_size > 0) {
+            sched->current = (q_index + 1) % sched->q_amount;
+            return q_index;
+        }
+    }
+    return -1;
+}
+
+//Deficit round-robin: every visit to a non-empty queue credits it with quantum
+//bytes, and it is served for as long as its deficit covers the head packet.
+//An empty queue loses its deficit so idle flows cannot save up credit. The
+//deficit is only debited by sched_charge(), for the packet that was sent: CoDel
+//may drop the head packet at dequeue, and a queue must not pay for that.
+int drr_pick(struct scheduler *sched, struct router_q *queues) {
+    int head_len;
+    struct router_q *q;
+
+    if (strict_pick(sched, queues) == -1) {
+        return -1; //all queues are empty
+    }
+    while (1) {
+        q = &queues[sched->current];
+        if (q->q_size == 0) {
+            sched->deficit[sched->current] = 0;
+        } else {
+            if (sched->new_round) {
+                sched->deficit[sched->current] += sched->quantum;
+                sched->new_round = 0;
+            }
+            head_len = queue_head_len(sched->pool, q);
+            if (sched->deficit[sched->current] >= head_len) {
+                return sched->current;
+            }
+        }
+        sched->current = (sched->current + 1) % sched->q_amount;
+        sched->new_round = 1;
+    }
+}
+
+//Charge queue q_index for a packet of len bytes sent from it. A packet behind
+//dropped ones may be longer than the deficit, the debt is paid next round.
+void sched_charge(struct scheduler *sched, unsigned int q_index, unsigned int len) {
+    if (sched->deficit != NULL) {
+        sched->deficit[q_index] -= len;
+    }
+}
+
+//Set up the scheduler called name ("strict", "rr" or "drr") for q_amount queues
+//of slots of pool. quantum is the number of bytes a DRR queue is credited per
+//round, by default the largest packet so every round can send at least one.
+//Returns 0 on success, -1 if the scheduler name is unknown.
+int sched_init(struct scheduler *sched, const char *name, unsigned int q_amount, unsigned int quantum, struct pkt_pool *pool) {
+    memset(sched, 0, sizeof (struct scheduler));
+    sched->q_amount = q_amount;
+    sched->pool = pool;
+    sched->quantum = quantum > 0 ? quantum : MSG_MAX_LEN;
+    sched->new_round = 1;
+    if (strcmp(name, "strict") == 0) {
+        sched->name = "strict";
+        sched->pick = strict_pick;
+    } else if (strcmp(name, "rr") == 0) {
+        sched->name = "rr";
+        sched->pick = rr_pick;
+    } else if (strcmp(name, "drr") == 0) {
+        sched->name = "drr";
+        sched->pick = drr_pick;
+        sched->deficit = calloc(q_amount, sizeof (int));
+        if (sched->deficit == NULL) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    return 0;
+}
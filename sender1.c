@@ -24,18 +24,33 @@
 
 //Input Arguments to sender.c:
 //argv[1] is Sender ID, which is either 1 (for Sender1) or 2 (for Sender2)
-//argv[2] is the mean value inter-packet time R in millisec (based on Poisson distr). 
+//argv[2] is the mean value inter-packet time R in millisec (based on Poisson distr),
+ //fractions such as 0.01 give rates above 1000 pkts/sec
 //argv[3] is the receiver ID, which is either 1 (Receiver1) or 2 (Receiver2)
 //argv[4] is the router IP
 //argv[5] is the time duration in seconds (dictates how long sender will send pkts to target).
+//Optional flags:
+//-l bytes is the payload size of every packet, from 0 up to MSG_MAX_PAYLOAD so
+//  the datagram fills one MTU (default DEFAULT_MSG_PAYLOAD)
+//-c trace_file records every packet sent in a binary trace (see trace.c);
+//  SIGINT/SIGTERM then stop the sender so the trace is flushed
+
+volatile sig_atomic_t sender_running = 1;
+
+//SIGINT/SIGTERM handler while tracing, ends the sending loop
+void sender_stop(int signum) {
+    sender_running = 0;
+}
 
 int main(int argc, char *argv[]) {
     //Variables used for input arguments
     unsigned int sender_id; 
-    unsigned int r; //inter-packet time W w/ mean R
+    double r; //inter-packet time W w/ mean R
     unsigned int receiver_id;
     char *dest_ip; //destination/router IP
     unsigned int duration; //sending time duration in seconds
+    int payload_len = DEFAULT_MSG_PAYLOAD, opt;
+    char *trace_path = NULL;
     
     //Variables used for establishing the connection
     int sockfd;
@@ -47,22 +62,38 @@ int main(int argc, char *argv[]) {
     unsigned int seq = 0;
     struct msg_payload *buffer;
     struct msg_payload payload;
-    struct timeval start_time;
-    struct timeval curr_time;
-    time_t delta_time = 0, curr_timestamp_sec = 0, curr_timestamp_usec = 0;
+    uint64_t start_time, curr_time; //monotonic clock in nanoseconds
+    uint64_t delta_time = 0;
+    struct pacer pacer; //schedules the send times
     //Variable used for alternating between sending and not sending
     unsigned int counter = 0;
-    //Parsing input arguments
-    if (argc != 6) {
+    //Parsing optional flags, then the input arguments
+    while ((opt = getopt(argc, argv, "l:c:")) != -1) {
+        switch (opt) {
+            case 'l':
+                if ((payload_len = msg_parse_payload(optarg)) == -1) {
+                    fprintf(stderr, "Sender: payload size must be between 0 and %lu bytes\n", (unsigned long)MSG_MAX_PAYLOAD);
+                    return 1;
+                }
+                break;
+            case 'c':
+                trace_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s sender_id r receiver_id router_ip duration [-l payload_bytes] [-c trace_file]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 5) {
         perror("Sender: incorrect number of command-line arguments\n");
         return 1; 
     } else {
-        sender_id = atoi(argv[1]);
-        r = atoi(argv[2]);
-        receiver_id = atoi(argv[3]);
-        dest_ip = argv[4];
-        duration = atoi(argv[5]);
-        printf("Sender id %d, r value %d, receiver id %1d, router IP address %s, port number %s, time duration is %d\n", sender_id, r, receiver_id, dest_ip, ROUTER_PORT, duration);
+        sender_id = atoi(argv[optind]);
+        r = strtod(argv[optind + 1], 0);
+        receiver_id = atoi(argv[optind + 2]);
+        dest_ip = argv[optind + 3];
+        duration = atoi(argv[optind + 4]);
+        printf("Sender id %d, r value %g, receiver id %1d, router IP address %s, port number %s, time duration is %d, payload %d bytes\n", sender_id, r, receiver_id, dest_ip, ROUTER_PORT, duration, payload_len);
     }
     
     //load struct addrinfo with host information
@@ -87,52 +118,60 @@ int main(int argc, char *argv[]) {
         return 3;
     }
     
+    if (trace_path != NULL) {
+        if (trace_open(trace_path) == -1) {
+            perror("Sender: unable to open trace file\n");
+            return 4;
+        }
+        signal(SIGINT, sender_stop);
+        signal(SIGTERM, sender_stop);
+    }
+
     //Establishing the packet: filling packet information
-    gettimeofday(&start_time, NULL);
-    gettimeofday(&curr_time, NULL);
-    curr_timestamp_sec = curr_time.tv_sec;
-    curr_timestamp_usec = curr_time.tv_usec; 
-    //curr_timestamp = abs(curr_time.tv_sec * ONE_MILLION) + abs(curr_time.tv_usec);
-    //printf("Current time: %f seconds %f microseconds\n", (double)curr_time.tv_sec, (double)curr_time.tv_usec);
-    //printf("Current timestamp is %d sec, %d usec\n", (int)curr_timestamp_sec, (int)curr_timestamp_usec);
+    start_time = now_ns();
+    curr_time = start_time;
     
     memset(&payload, 0, sizeof payload);
     buffer = &payload;
     buffer->seq = htonl(seq++); //packet sequence ID
     buffer->sender_id = htonl(sender_id); //Sender ID
     buffer->receiver_id = htonl(receiver_id); //Receiver ID
-    buffer->timestamp_sec = htonl(curr_timestamp_sec); //Pkt timestamp_sec
-    buffer->timestamp_usec = htonl(curr_timestamp_usec); //Pkt timestamp_usec
+    msg_set_len(buffer, payload_len);
+    pacer_init(&pacer, r, start_time ^ ((uint64_t)getpid() << 32));
     
-    while (1) {
-        while (counter < 5) {
+    while (sender_running) {
+        while (counter < 5 && sender_running) {
             counter++;
             usleep(1000000); //system sleep for one second
-            gettimeofday(&start_time, NULL);
-            gettimeofday(&curr_time, NULL);
-            delta_time = (curr_time.tv_sec * ONE_MILLION + curr_time.tv_usec) - (start_time.tv_sec * ONE_MILLION + start_time.tv_usec);
+            start_time = now_ns();
+            curr_time = start_time;
+            delta_time = 0;
+            pacer.next_ns = start_time; //the first packet of a burst goes out right away
         }
-        while ((delta_time / ONE_MILLION) < duration) {
+        while ((delta_time / ONE_BILLION) < duration && sender_running) {
+            //Wait for the scheduled send time
+            pacer_sleep(&pacer);
+            //Stamp the header version and send time right before sending
+            curr_time = now_ns();
+            msg_stamp(buffer, curr_time);
             //printf("%s: payload size is %f Bytes\n", __func__, (double)sizeof(payload));
-            printf("Pkt data: seq#-%d, senderID-%d, receiverID-%d, timestamp_sec-%d, timestamp_usec %d\n", ntohl(buffer->seq), ntohl(buffer->sender_id), ntohl(buffer->receiver_id), ntohl(buffer->timestamp_sec), ntohl(buffer->timestamp_usec));
-            packet_success = sendto(sockfd, buffer, sizeof(struct msg_payload), 0, receiver_info->ai_addr, receiver_info->ai_addrlen);
-            printf("Sender 1: time: %d Total packets sent so far: %d\n", (int)curr_time.tv_sec, seq);
-            poisson_delay((double)r);
-            gettimeofday(&curr_time, NULL);
-            //delta_time is elapsed time in microseconds
-            //   (divide by ONE_MILLION to get seconds)
-            delta_time = (curr_time.tv_sec * ONE_MILLION + curr_time.tv_usec) - (start_time.tv_sec * ONE_MILLION + start_time.tv_usec);
-            
-            //Get the timestamp for the next packet
-            curr_timestamp_sec = curr_time.tv_sec;
-            curr_timestamp_usec = curr_time.tv_usec;
-            buffer->timestamp_sec = htonl((long)curr_timestamp_sec);
-            buffer->timestamp_usec = htonl((long)curr_timestamp_usec);
+            printf("Pkt data: seq#-%d, senderID-%d, receiverID-%d, timestamp_ns-%llu\n", ntohl(buffer->seq), ntohl(buffer->sender_id), ntohl(buffer->receiver_id), (unsigned long long)msg_timestamp_ns(buffer));
+            packet_success = sendto(sockfd, buffer, msg_len(buffer), 0, receiver_info->ai_addr, receiver_info->ai_addrlen);
+            if (packet_success > 0) {
+                trace_msg(TRACE_TX, buffer, curr_time);
+            }
+            printf("Sender 1: time: %d Total packets sent so far: %d\n", (int)(curr_time / ONE_BILLION), seq);
+            curr_time = now_ns();
+            pacer_advance(&pacer, curr_time);
+            //delta_time is elapsed time in nanoseconds
+            //   (divide by ONE_BILLION to get seconds)
+            delta_time = elapsed_ns(start_time, curr_time);
             buffer->seq = htonl(seq++);
-            //printf("Sender: Delta time: %d usec, current time of seconds: %d sec, current time of microsec: %d microsec\n", (int)delta_time, (int)curr_timestamp_sec, (int)curr_timestamp_usec);
+            //printf("Sender: Delta time: %llu nsec\n", (unsigned long long)delta_time);
             counter = 0;
         }
     }
+    trace_close();
     close(sockfd);
     return 0; 
 }
\ No newline at end of file
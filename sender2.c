@@ -18,60 +18,60 @@
 #include <sys/time.h>
 #include <sys/fcntl.h>
 #include <math.h>
+#include <endian.h>
 #include "common.h"
 
-#define MIN_WINDOW_SIZE 1
-#define MAX_WINDOW_SIZE 128
 //Input Arguments to sender.c:
 //argv[1] is Sender ID, which is either 1 (for Sender1) or 2 (for Sender2)
-//argv[2] is the mean value inter-packet time R in millisec (based on Poisson distr). 
+//argv[2] is the mean value inter-packet time R in millisec (based on Poisson distr),
+ //fractions such as 0.01 give rates above 1000 pkts/sec
 //argv[3] is the receiver ID, which is either 1 (Receiver1) or 2 (Receiver2)
 //argv[4] is the router IP
 //argv[5] is the size of the sliding window for Go-Back-N ARQ (default should be 32 packets)
 //argv[6] is the initial timeout time (in milliseconds) for Go-Back-N
  // ARQ (it is only used once, after the first packet is received, the
  // timeout time is estimated using adaptive exponential averaging)
-//argv[7] is the option for AIMD (additive increase, multiplicative decrease)
- //If Sender is using AIMD, argv[7] is 1. If not, argv[7] is 0.
+//argv[7] is the congestion controller that sizes the window: none (fixed
+ //window), aimd (additive increase, multiplicative decrease), reno, cubic or
+ //delay. 0 and 1 still select none and aimd, the old AIMD option values.
+//Optional flags:
+//-m gbn|sr selects the ARQ mode, Go-Back-N (default) or selective repeat
+//-l bytes is the payload size of every packet, from 0 up to MSG_MAX_PAYLOAD so
+//  the datagram fills one MTU (default DEFAULT_MSG_PAYLOAD)
+//-c trace_file records every packet sent and every ACK received in a binary
+//  trace (see trace.c)
 
-//Function to obtain the exponential avg of packet round-trip-times (in ms)
-//Used in estimating the sender window timeout time
-//Based on the equation A(n+1) = (1-b)*A(n) + b*T(n+1), where:
-//A(n) is the exponential average RTT, b is a pre-chosen parameter value (typically 0.875), T(n) is the RTT of the current packet
-double avg_round_trip_time(double avg_so_far, double curr_rtt, double b) {
-    double exp_avg = 0.0;
-    exp_avg = ((1-b)*avg_so_far) + (b*curr_rtt);
-    //printf("%s: average RTT is %f us\n", __func__, exp_avg);
-    return exp_avg;
-}
+volatile sig_atomic_t sender_running = 1;
 
-//Function to obtain the exponential avg of round-trip-time deviation (in ms)
-//Used in estimating the sender window timeout time
-//Based on the equation D(n+1) = (1-b)*D(n) + b*|T(n+1) - A(n+1)|, where:
-//D(n) is the exponential average deviation, b is a pre-chosen parameter value (typically 0.75), T(n) is the RTT of the current packet
-double avg_deviation(double dev_so_far, double curr_rtt, double exp_avg, double b) {
-    double exp_dev = 0.0;
-    exp_dev = (1.0-b)*dev_so_far+ b*abs(curr_rtt - exp_avg);
-    //printf("%s: deviation is %f ms\n", __func__, exp_dev);
-    return exp_dev;
+//SIGINT/SIGTERM handler, stops the send loop so the RTT statistics get printed
+void sender_stop(int signum) {
+    sender_running = 0;
 }
 
-//Function to obtain the timeout time for the Sender's sliding window (in ms)
-double timeout(double exp_avg_rtt, double deviation) {
-    double timeout_t = exp_avg_rtt + 4.0*deviation;
-    //printf("%s: timeout time is %f ms\n", __func__, timeout_t);
-    return timeout_t;
+//Selective repeat: stamp and send packet seq, and (re)start its retransmit timer
+void sr_send(struct sr_state *sr, int sockfd, struct addrinfo *dest, struct msg_payload *pkt, unsigned int seq, uint64_t rto_ns, int resend) {
+    uint64_t now = now_ns();
+
+    pkt->seq = htonl(seq);
+    msg_stamp(pkt, now);
+    if (sendto(sockfd, pkt, msg_len(pkt), 0, dest->ai_addr, dest->ai_addrlen) > 0) {
+        trace_msg(TRACE_TX, pkt, now);
+    }
+    sr_arm(sr, seq, rto_ns, resend, now);
 }
 
 int main(int argc, char *argv[]) {
     //Variables used for input arguments
     unsigned int sender_id; 
-    unsigned int r; //inter-packet time W w/ mean R
+    double r; //inter-packet time W w/ mean R
     unsigned int receiver_id;
     char *dest_ip; //destination/router IP
     unsigned int slide_window_size;
     double timeout_time = 0.0;
-    unsigned int aimd_option;
+    char *cc_name;
+    int arq_mode = ARQ_GBN, opt;
+    int payload_len = DEFAULT_MSG_PAYLOAD;
+    char *trace_path = NULL;
     
     //Variables used for establishing the connection
     int sockfd, listen_sockfd;
@@ -84,36 +84,81 @@ int main(int argc, char *argv[]) {
     int packet_success;
     struct msg_payload *buffer;
     struct msg_payload payload;
-    struct timeval start_time;
-    struct timeval curr_time;
-    struct timeval last_tx_time;
-    time_t delta_time = 0, curr_timestamp_sec = 0, curr_timestamp_usec = 0;
+    uint64_t curr_time; //monotonic clock in nanoseconds
+    struct pacer pacer; //schedules the send times
+    uint64_t wake_time;
+    double delta_time = 0; //elapsed time in milliseconds
     unsigned int total_pkts_sent = 0;
     //Variables used for incoming packets
     int recv_success;
-    struct msg_payload *buff;
+    struct ack_payload *ack;
+    unsigned int ack_seq = 0; //cumulative ACK of the last ACK received, host byte order
     
     //Variables used for the sliding window Go-Back-N ARQ
     unsigned int next_seq_no = 0, beg_seq_no = 0, recv_no = 0;
+    struct gbn_state gbn;
+    //Variables used for selective repeat ARQ
+    struct sr_state sr;
+    unsigned int prev_beg_seq_no;
+    int rtx_slot, had_loss;
+    //Congestion control
+    struct cong_ctrl cc;
+    uint64_t run_start; //when the first packet was sent, for the goodput
+    uint64_t rto_ns;
     
     //Variables used for estimation of packet timeout value
     unsigned int ack_pkt_cnt = 0;
     double avg_rtt = 0, current_rtt = 0, avg_dev = 0; //units are in ms
-    int has_acks = 0;
+    uint64_t rtt_ns = 0;
+    struct latency_hist rtt_hist; //RTT distribution in nanoseconds
     
-    //Parsing input arguments
-    if (argc != 8) {
+    //Parsing optional flags, then the input arguments
+    while ((opt = getopt(argc, argv, "m:l:c:")) != -1) {
+        switch (opt) {
+            case 'm':
+                if (strcmp(optarg, "gbn") == 0) {
+                    arq_mode = ARQ_GBN;
+                } else if (strcmp(optarg, "sr") == 0) {
+                    arq_mode = ARQ_SR;
+                } else {
+                    fprintf(stderr, "Sender 2: unknown ARQ mode %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                if ((payload_len = msg_parse_payload(optarg)) == -1) {
+                    fprintf(stderr, "Sender 2: payload size must be between 0 and %lu bytes\n", (unsigned long)MSG_MAX_PAYLOAD);
+                    return 1;
+                }
+                break;
+            case 'c':
+                trace_path = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s sender_id r receiver_id router_ip window_size timeout none|aimd|reno|cubic|delay [-m gbn|sr] [-l payload_bytes] [-c trace_file]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 7) {
         perror("Sender 2: incorrect number of command-line arguments\n");
         return 1; 
     } else {
-        sender_id = atoi(argv[1]);
-        r = atoi(argv[2]);
-        receiver_id = atoi(argv[3]);
-        dest_ip = argv[4];
-        slide_window_size = atoi(argv[5]);
-        timeout_time = strtod(argv[6],0);
-        aimd_option = atoi(argv[7]);
-        //printf("Sender id %d, r value %d, receiver id %d, router IP address %s, port number %s, sliding window size is %d, the timeout time is %f, AIMD option is %d\n", sender_id, r, receiver_id, dest_ip, ROUTER_PORT, slide_window_size, timeout_time, aimd_option);
+        sender_id = atoi(argv[optind]);
+        r = strtod(argv[optind + 1], 0);
+        receiver_id = atoi(argv[optind + 2]);
+        dest_ip = argv[optind + 3];
+        slide_window_size = atoi(argv[optind + 4]);
+        timeout_time = strtod(argv[optind + 5],0);
+        cc_name = argv[optind + 6];
+        if (slide_window_size < MIN_WINDOW_SIZE || slide_window_size > MAX_WINDOW_SIZE) {
+            fprintf(stderr, "Sender 2: window size must be between %d and %d\n", MIN_WINDOW_SIZE, MAX_WINDOW_SIZE);
+            return 1;
+        }
+        if (cc_init(&cc, cc_name, slide_window_size, MIN_WINDOW_SIZE, MAX_WINDOW_SIZE) == -1) {
+            fprintf(stderr, "Sender 2: unknown congestion controller %s\n", cc_name);
+            return 1;
+        }
+        //printf("Sender id %d, r value %d, receiver id %d, router IP address %s, port number %s, sliding window size is %d, the timeout time is %f, congestion control is %s\n", sender_id, r, receiver_id, dest_ip, ROUTER_PORT, slide_window_size, timeout_time, cc.name);
     }
     
     //load struct addrinfo with host information
@@ -164,132 +209,173 @@ int main(int argc, char *argv[]) {
     buffer = &payload;
     buffer->sender_id = htonl(sender_id); //Sender ID
     buffer->receiver_id = htonl(receiver_id); //Receiver ID
+    msg_set_len(buffer, payload_len);
 
     addr_len = sizeof their_addr;
-    //Memory set timeval structs for calculuating elapsed time
-    memset(&curr_time, 0, sizeof (struct timeval));
-    memset(&start_time, 0, sizeof (struct timeval));
-    //gettimeofday(&start_time, NULL);
+    //Start the clock used for the goodput
+    curr_time = now_ns();
+    run_start = curr_time;
     //allocate memory to buffer incoming ACK packets
-    buff = malloc(sizeof (struct msg_payload));
-    memset(buff, 0, sizeof (struct msg_payload));
+    ack = malloc(sizeof (struct ack_payload));
+    memset(ack, 0, sizeof (struct ack_payload));
     //init timeout_time = r
-    timeout_time = (double)r;
+    timeout_time = r;
+    pacer_init(&pacer, r, curr_time ^ ((uint64_t)getpid() << 32));
+    hist_init(&rtt_hist);
+    memset(&sr, 0, sizeof sr);
+    if (arq_mode == ARQ_SR && sr_init(&sr, MAX_WINDOW_SIZE, curr_time) == -1) {
+        perror("Sender 2: unable to allocate the retransmit timers\n");
+        return 7;
+    }
+    if (arq_mode == ARQ_GBN && gbn_init(&gbn) == -1) {
+        perror("Sender 2: unable to allocate the Go-Back-N window\n");
+        return 7;
+    }
+    if (trace_path != NULL && trace_open(trace_path) == -1) {
+        perror("Sender 2: unable to open trace file\n");
+        return 8;
+    }
+    signal(SIGINT, sender_stop);
+    signal(SIGTERM, sender_stop);
     
-    while (1) {
-        //Send packets within the window size
-        if (next_seq_no < (beg_seq_no + slide_window_size)) {
-            buffer->seq = htonl(next_seq_no); //pkt sequence ID, initialized at 0
-            //Get the current packet timestamp
-            gettimeofday(&curr_time, NULL);
-            last_tx_time = curr_time;
-            curr_timestamp_sec = curr_time.tv_sec;
-            curr_timestamp_usec = curr_time.tv_usec;
-            buffer->timestamp_sec = htonl(curr_timestamp_sec); //Pkt timestamp_sec
-            buffer->timestamp_usec = htonl(curr_timestamp_usec); //Pkt timestamp_usec
-            printf("SENT Pkt data: seq#-%d, senderID-%d, receiverID-%d, timestamp_sec-%d, timestamp_usec %d\n", ntohl(buffer->seq), ntohl(buffer->sender_id), ntohl(buffer->receiver_id), ntohl(buffer->timestamp_sec), ntohl(buffer->timestamp_usec));
-            //printf("Sender 2 current window size: %d\n", slide_window_size);
-            //Send packet
-            packet_success = sendto(sockfd, buffer, sizeof(struct msg_payload), 0, receiver_info->ai_addr, receiver_info->ai_addrlen);
-            total_pkts_sent++;
-            printf("Sender 2: time: %d, Total packets sent so far: %d\n",(int)curr_time.tv_sec, total_pkts_sent);
-            poisson_delay((double)r);
-            //Update the packet sequence ID
-            next_seq_no++;
+    while (sender_running) {
+        //the timeout is at least one tick, so a resent packet cannot expire again right away
+        rto_ns = timeout_time * ONE_MILLION > RTX_TICK_NS ? (uint64_t)(timeout_time * ONE_MILLION) : RTX_TICK_NS;
+        if (arq_mode == ARQ_SR) {
+            //Selective repeat: resend only the packets whose own timer expired
+            had_loss = 0;
+            while ((rtx_slot = tw_expire(&sr.rtx_wheel, now_ns())) != -1) {
+                //the slot's packet is the one in [base, base + capacity) that maps to it
+                sr_send(&sr, sockfd, receiver_info, buffer, sr.acked.base + ((rtx_slot - sr.acked.base) & sr.acked.mask), rto_ns, 1);
+                sr.retransmits++;
+                total_pkts_sent++;
+                had_loss = 1;
+            }
+            if (had_loss) {
+                //selective repeat has no duplicate ACKs, an expired timer is its loss signal
+                cc_on_loss(&cc, now_ns());
+                slide_window_size = cc_window(&cc);
+            }
+            if (next_seq_no < (beg_seq_no + slide_window_size) && pacer_due(&pacer, now_ns())) {
+                sr_send(&sr, sockfd, receiver_info, buffer, next_seq_no, rto_ns, 0);
+                total_pkts_sent++;
+                next_seq_no++;
+                printf("Sender 2: Total packets sent so far: %d | window [%u, %u)\n", total_pkts_sent, beg_seq_no, next_seq_no);
+                pacer_advance(&pacer, now_ns());
+            }
         } else {
-            // check to see if last tx time till now is already > timeout
-            gettimeofday(&curr_time, NULL);
-            delta_time = ((curr_time.tv_sec * ONE_MILLION + curr_time.tv_usec) - (last_tx_time.tv_sec * ONE_MILLION+ last_tx_time.tv_usec))/1000;
-            if (delta_time >= timeout_time) { //originally used delta_time >= 3*r
-                // retry last seq no again
-                next_seq_no--;
-                continue;
+            //Go-Back-N: once the oldest unacknowledged packet times out, resend the window from it
+            if (gbn_on_timeout(&gbn, &cc, beg_seq_no, &next_seq_no, rto_ns, now_ns())) {
+                slide_window_size = cc_window(&cc);
+            }
+            //Send packets within the window size, when the pacer says so
+            if (next_seq_no < (beg_seq_no + slide_window_size) && pacer_due(&pacer, now_ns())) {
+                buffer->seq = htonl(next_seq_no); //pkt sequence ID, initialized at 0
+                //Get the current packet timestamp
+                curr_time = now_ns();
+                gbn_sent(&gbn, next_seq_no, curr_time);
+                msg_stamp(buffer, curr_time); //header version and pkt timestamp
+                printf("SENT Pkt data: seq#-%d, senderID-%d, receiverID-%d, timestamp_ns-%llu\n", ntohl(buffer->seq), ntohl(buffer->sender_id), ntohl(buffer->receiver_id), (unsigned long long)curr_time);
+                //printf("Sender 2 current window size: %d\n", slide_window_size);
+                //Send packet
+                packet_success = sendto(sockfd, buffer, msg_len(buffer), 0, receiver_info->ai_addr, receiver_info->ai_addrlen);
+                if (packet_success > 0) {
+                    trace_msg(TRACE_TX, buffer, curr_time);
+                }
+                total_pkts_sent++;
+                printf("Sender 2: time: %d, Total packets sent so far: %d\n",(int)(curr_time / ONE_BILLION), total_pkts_sent);
+                pacer_advance(&pacer, curr_time);
+                //Update the packet sequence ID
+                next_seq_no++;
             }
         }
 
-        has_acks = 0;
+        //Sleep until the next send is due, a timer needs checking or an ACK arrives
+        wake_time = now_ns() + RTX_TICK_NS;
+        if (next_seq_no < (beg_seq_no + slide_window_size) && pacer.next_ns < wake_time) {
+            wake_time = pacer.next_ns;
+        }
+        wait_readable(listen_sockfd, wake_time);
+
         //Receive and process ACK packets from listening socket
-        while (recv_success = recvfrom(listen_sockfd, buff, sizeof (struct msg_payload), 0, (struct sockaddr *)&their_addr, &addr_len)) {
-                if (recv_success > 0) {//received ACK packet
+        while (recv_success = recvfrom(listen_sockfd, ack, sizeof (struct ack_payload), 0, (struct sockaddr *)&their_addr, &addr_len)) {
+                if (recv_success > 0 && ack_valid(ack, recv_success)) {//received ACK packet
                     ack_pkt_cnt++; //increment ACK packet counter
-                    has_acks = 1;
-                    buff->seq = ntohl(buff->seq);
-                    buff->sender_id = ntohl(buff->sender_id);
-                    buff->receiver_id = ntohl(buff->receiver_id);
-                    buff->timestamp_sec = ntohl(buff->timestamp_sec);
-                    buff->timestamp_usec = ntohl(buff->timestamp_usec);
-                    // printf("ACK Pkt count: %d seq %d\n", ack_pkt_cnt, buff->seq);
-                    //printf("RECEIVED Pkt data: seq#-%d, senderID-%d, receiverID-%d, timestamp_sec-%d, timestamp_usec:%d\n", buff->seq, buff->sender_id, buff->receiver_id, (int)buff->timestamp_sec, (int)buff->timestamp_usec);
+                    ack_seq = ntohl(ack->cum_ack);
+                    trace_event(TRACE_ACK, sender_id, receiver_id, ack_seq, recv_success, now_ns());
+                    // printf("ACK Pkt count: %d seq %d\n", ack_pkt_cnt, ack_seq);
+                    //printf("RECEIVED ACK data: cum ack-%u, echo_ns-%llu, ack delay-%u ns\n", ack_seq, (unsigned long long)be64toh(ack->echo_ns), ntohl(ack->ack_delay_ns));
                 
+                } else if (recv_success > 0) {
+                    continue; //unknown header version or not an ACK, ignore it
                 } else {
                     //break out from the receiving ACK while loop
                     break;
                 }            
                 //Estimate new timeout time using exponential averaging
-                gettimeofday(&curr_time, NULL);
-                //Get current RTT in milliseconds
-                current_rtt = (ONE_MILLION * (curr_time.tv_sec - buff->timestamp_sec) + (curr_time.tv_usec - buff->timestamp_usec))/1000;
-                //printf("Current time: %d sec %d usec, timestamp: %d sec %d usec\n", (int)curr_time.tv_sec, (int)curr_time.tv_usec, buff->timestamp_sec, buff->timestamp_usec);
+                curr_time = now_ns();
+                //Get current RTT from the send timestamp echoed in the ACK, in milliseconds,
+                //without the time the receiver held the packet back for a delayed ACK
+                rtt_ns = elapsed_ns(be64toh(ack->echo_ns) + ntohl(ack->ack_delay_ns), curr_time);
+                hist_record(&rtt_hist, rtt_ns);
+                current_rtt = rtt_ns / (double)ONE_MILLION;
+                //printf("Current time: %llu nsec, timestamp: %llu nsec\n", (unsigned long long)curr_time, (unsigned long long)be64toh(ack->echo_ns));
                 if (ack_pkt_cnt == 1) {//1st ACK packet received
                     avg_rtt = current_rtt;
                     avg_dev = current_rtt;
                     //printf("RTT for 1st received ACK pkt: %f usec\n", avg_rtt);
                 }
                 if (ack_pkt_cnt > 1) {//All subsequent ACKs received
-                    gettimeofday(&curr_time, NULL);
                     //printf("Initial avg RTT %f, initial avg deviation %f, current RTT %f\n", avg_rtt, avg_dev, current_rtt);
-                    avg_rtt = avg_round_trip_time(avg_rtt, current_rtt, 0.875);
-                    avg_dev = avg_deviation(avg_dev, current_rtt, avg_rtt, 0.75);
+                    if (arq_mode == ARQ_SR) {
+                        //Selective repeat times out every packet on its own, so
+                        //it needs the smoother RFC 6298 gains (1/8 and 1/4) or
+                        //every jump in RTT resends the whole window
+                        avg_rtt = avg_round_trip_time(avg_rtt, current_rtt, 0.125);
+                        avg_dev = avg_deviation(avg_dev, current_rtt, avg_rtt, 0.25);
+                    } else {
+                        avg_rtt = avg_round_trip_time(avg_rtt, current_rtt, 0.875);
+                        avg_dev = avg_deviation(avg_dev, current_rtt, avg_rtt, 0.75);
+                    }
                     //printf("Calculated avg RTT %f, calculated avg deviation %f\n", avg_rtt, avg_dev);
                 }
                 //New timeout_time
                 timeout_time = timeout(avg_rtt, avg_dev);
-                gettimeofday(&start_time, NULL);
-                //printf("The time out time is %f , Current time: %d\n", timeout_time, (int)start_time.tv_sec);
-                /*Shift the window if Sender 2 receives an ACK for a
-                 packet sequence ID outside of the current window, or if
-                 the packet sequence ID is smaller than the current
-                 sequence number (next_seq_no) and S2 has timed out*/
-        }
-        
-        if (has_acks) {
-            //Decide whether to expand or shrink window based on the last ACK sequence number
-            if (buff->seq == next_seq_no) {
-                beg_seq_no++;
-                //AIMD to change the window size based on ACKS recvd
-                if (aimd_option == 1) {
-                    //double sliding window size if there is no pkt loss
-                    slide_window_size++;
-                    if (slide_window_size > MAX_WINDOW_SIZE) {
-                        slide_window_size = MAX_WINDOW_SIZE;
+                if (arq_mode == ARQ_SR) {
+                    //Every ACK is processed, its SACK bits stop the timers of
+                    //the packets received out of order
+                    prev_beg_seq_no = beg_seq_no;
+                    beg_seq_no = sr_on_ack(&sr, ack_seq, ack->sack, next_seq_no);
+                    if (beg_seq_no > prev_beg_seq_no) {
+                        cc_on_ack(&cc, beg_seq_no - prev_beg_seq_no, rtt_ns, curr_time);
+                        slide_window_size = cc_window(&cc);
                     }
-                    //printf("Time: %d, Window size updated to %d\n", (int)start_time.tv_sec, slide_window_size);
+                    continue;
                 }
-            } else {
-                //receiver is still ACKING an older pkt
-                //Reduce window size by half
-                if (aimd_option == 1) {
-                    slide_window_size /= 2;
-                    if (slide_window_size < MIN_WINDOW_SIZE) {
-                        slide_window_size = MIN_WINDOW_SIZE;
-                    }
-                    //printf("Time: %d, Window size updated to %d\n", (int)start_time.tv_sec, slide_window_size);
-                }
-                //delta_time is elapsed time in milliseconds
-                gettimeofday(&curr_time, NULL);
-                delta_time = ((curr_time.tv_sec * ONE_MILLION + curr_time.tv_usec) - (start_time.tv_sec * ONE_MILLION+ start_time.tv_usec))/1000;
-                // printf("Elapsed (Delta) time for Sender 2: %f ms\n", (float)delta_time);
-                if ((buff->seq < next_seq_no) && (delta_time >= timeout_time)|| (buff->seq >= (beg_seq_no + slide_window_size))) {
-                    //printf("*****TIMEOUT time: %f, Current time: %d\n", timeout_time, (int)curr_time.tv_sec);
-                    beg_seq_no = buff->seq;
-                    next_seq_no = buff->seq;
-                    //reset the timer
-                    gettimeofday(&curr_time, NULL);
-                    gettimeofday(&start_time, NULL);
-                }
-            }
+                //Go-Back-N: a new cumulative ACK slides the window, a run of
+                //GBN_DUP_ACKS duplicate ones resends it
+                gbn_on_ack(&gbn, &cc, ack_seq, &beg_seq_no, &next_seq_no, rtt_ns, curr_time);
+                slide_window_size = cc_window(&cc);
         }
     }
+    printf("Sender 2 stats: sent %u pkts | received %u ACKs\n", total_pkts_sent, ack_pkt_cnt);
+    //goodput counts each packet once, when the window moves past it
+    delta_time = elapsed_ns(run_start, now_ns()) / (double)ONE_BILLION;
+    printf("Sender 2 stats: congestion control %s | final window %u pkts | goodput %.1f pkts/sec\n",
+           cc.name, slide_window_size, delta_time > 0 ? beg_seq_no / delta_time : 0.0);
+    if (rtt_hist.total_count > 0) {
+        //RTT above the smallest one seen is time spent waiting in queues
+        printf("Sender 2 stats: queueing delay p50 %llu nsec | p99 %llu nsec\n",
+               (unsigned long long)(hist_percentile(&rtt_hist, 50.0) - rtt_hist.min),
+               (unsigned long long)(hist_percentile(&rtt_hist, 99.0) - rtt_hist.min));
+    }
+    if (arq_mode == ARQ_SR) {
+        printf("Sender 2 stats: selective repeat retransmitted %lu pkts\n", sr.retransmits);
+    } else {
+        printf("Sender 2 stats: go-back-n retransmitted %lu pkts\n", gbn.retransmits);
+    }
+    hist_print(&rtt_hist, "Sender 2 stats: RTT", "nsec");
+    trace_close();
     close(sockfd);
     close(listen_sockfd);
     return 0;
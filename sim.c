@@ -0,0 +1,748 @@
+// EE122 Project 2 - sim.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// sim.c is a deterministic discrete-event simulation of the whole pipeline:
+// Sender 1 and Sender 2 send through the router, which serves its queues every
+// dq_time, to Receiver 1 and Receiver 2, and Receiver 2 acknowledges back to
+// Sender 2. Nothing sleeps: every action is an event on a virtual nanosecond
+// clock, taken in time order from a binary heap, so thousands of simulated
+// seconds run per second of wall time. All randomness comes from generators
+// seeded with -s, so two runs with the same arguments print the same numbers.
+// The router queues and their AQM and scheduler, Sender 2's timeout estimator,
+// selective repeat and congestion controllers, the pacers and Receiver 2's
+// reorder window and ACKs are the same code the live binaries run.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <endian.h>
+#include <time.h>
+#include "common.h"
+
+//Input Arguments to sim.c (all optional, the defaults in brackets):
+//-t sim_sec is the simulated time in seconds [60]
+//-s seed seeds every random number generator [1]
+//-n q_amount, -d dq_time_ms and -m max_q_size are the router arguments [2, 1, 100];
+// dq_time may be fractional, 0 forwards every packet as soon as it arrives
+//-S strict|rr|drr, -q quantum and -a none|red|codel are the router's scheduler,
+// DRR quantum and AQM policy (applied to every queue) [strict, MSG_MAX_LEN, none]
+//-p r1_ms is Sender 1's mean inter-packet time, 0 turns Sender 1 off [10]
+//-o on_sec is how long Sender 1 sends before its 5 second pause [10]
+//-P r2_ms is Sender 2's mean inter-packet time, 0 turns Sender 2 off [10]
+//-w window_size, -c congestion controller and -M gbn|sr are Sender 2's window,
+// controller and ARQ mode [32, none, gbn]
+//-k ack_every and -D ack_delay_us are Receiver 2's delayed ACK settings [2, 2000]
+//-l payload_bytes is the payload size of every packet [DEFAULT_MSG_PAYLOAD]
+//-L link_delay_us is the one-way delay of every hop, standing in for the host
+// stack and loopback [20]
+//-B rcvbuf_pkts is the receive socket buffer of Receiver 2 in packets [256]
+//-C prints a single CSV result row instead of the statistics, -H prints the
+// CSV header line and exits
+
+#define SIM_OFF_NS (5 * ONE_BILLION) //Sender 1 pauses 5 seconds between sending periods
+#define SIM_B_PERIOD_NS (5 * ONE_BILLION) //Receiver 2 switches its delay bound every 5 seconds
+#define SIM_POOL_SLACK 1024 //packet buffers for the links on top of every queue and window
+
+//Event types
+#define EV_S1_SEND 0 //Sender 1's pacer is due
+#define EV_S2_WAKE 1 //Sender 2 has a send or a timer due
+#define EV_S2_ACK 2 //an ACK reaches Sender 2
+#define EV_ROUTER_ARRIVE 3 //a packet reaches the router
+#define EV_ROUTER_SERVICE 4 //the dq_time service timer fires
+#define EV_RX_ARRIVE 5 //a packet reaches its receiver
+#define EV_R2_POLL 6 //Receiver 2's loop reads its socket
+#define EV_R2_ACK_TIMER 7 //Receiver 2's delayed ACK timer fires
+
+//One pending event. Events at the same time run in the order they were
+//scheduled, so the run does not depend on the heap's tie breaking.
+struct sim_event {
+    uint64_t time;
+    uint64_t order;
+    int type;
+    unsigned int arg; //pool slot of the packet, or generation of a timer
+    struct ack_payload *ack;
+};
+
+//Min-heap of pending events ordered by (time, order)
+struct event_heap {
+    struct sim_event *events;
+    unsigned int size, capacity;
+    uint64_t next_order;
+};
+
+struct sim_router {
+    struct pkt_pool pool; //buffers of every packet in flight anywhere in the simulation
+    struct router_q *queues;
+    struct aqm *aqms;
+    struct latency_hist *occupancy;
+    struct scheduler sched;
+    unsigned int q_amount, max_q_size, n_dest;
+    uint64_t dq_ns;
+    unsigned long rcvd, sent, rx_bytes, tx_bytes, unroutable, pool_drops;
+};
+
+struct sim_sender1 {
+    struct pacer pacer;
+    double r;
+    uint64_t on_ns, on_end_ns;
+    unsigned int seq;
+    unsigned long sent;
+};
+
+//Sender 2, with the variables of sender2.c's main loop
+struct sim_sender2 {
+    int arq_mode;
+    struct pacer pacer;
+    double r;
+    struct cong_ctrl cc;
+    struct sr_state sr;
+    struct gbn_state gbn;
+    unsigned int slide_window_size, next_seq_no, beg_seq_no, total_pkts_sent, ack_pkt_cnt;
+    double timeout_time, avg_rtt, avg_dev; //ms
+    struct latency_hist rtt_hist;
+    unsigned int wake_gen; //only the newest wake-up event is acted on
+};
+
+struct sim_receiver {
+    unsigned long rcvd, bytes;
+    struct latency_hist delay;
+};
+
+//Receiver 2, with the variables of receiver2.c's main loop
+struct sim_receiver2 {
+    struct sim_receiver rx;
+    struct router_q sockbuf; //datagrams waiting in the socket, as pool slots
+    uint64_t rng[4]; //draws the processing delay of every loop
+    int idle; //the loop waits for the next datagram instead of polling
+    struct seq_window window;
+    unsigned int next_seq_no, slide_window_size, ack_every, unacked_cnt;
+    uint64_t ack_delay_ns, last_echo_ns, last_arrival_time;
+    unsigned int ack_gen; //only the newest delayed ACK timer is acted on
+    unsigned long acks_sent, sockbuf_drops;
+};
+
+struct event_heap heap;
+struct sim_router router;
+struct sim_sender1 s1;
+struct sim_sender2 s2;
+struct sim_receiver r1;
+struct sim_receiver2 r2;
+uint64_t sim_now, sim_end;
+uint64_t link_ns;
+unsigned int payload_len = DEFAULT_MSG_PAYLOAD;
+unsigned long n_events;
+
+//Schedule an event of type at time
+void sim_schedule(uint64_t time, int type, unsigned int arg, struct ack_payload *ack) {
+    struct sim_event ev, *new_events;
+    unsigned int i, parent;
+
+    if (heap.size == heap.capacity) {
+        heap.capacity = heap.capacity ? 2 * heap.capacity : 1024;
+        new_events = realloc(heap.events, heap.capacity * sizeof (struct sim_event));
+        if (new_events == NULL) {
+            perror("Sim: out of memory for events\n");
+            exit(1);
+        }
+        heap.events = new_events;
+    }
+    ev.time = time;
+    ev.order = heap.next_order++;
+    ev.type = type;
+    ev.arg = arg;
+    ev.ack = ack;
+    i = heap.size++;
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (heap.events[parent].time < ev.time
+            || (heap.events[parent].time == ev.time && heap.events[parent].order < ev.order)) {
+            break;
+        }
+        heap.events[i] = heap.events[parent];
+        i = parent;
+    }
+    heap.events[i] = ev;
+}
+
+//Non-zero if event a runs before event b
+int event_before(struct sim_event *a, struct sim_event *b) {
+    return a->time < b->time || (a->time == b->time && a->order < b->order);
+}
+
+//Take the earliest event off the heap. Returns 0, or -1 if none is left.
+int sim_next(struct sim_event *ev) {
+    struct sim_event last;
+    unsigned int i = 0, child;
+
+    if (heap.size == 0) {
+        return -1;
+    }
+    *ev = heap.events[0];
+    last = heap.events[--heap.size];
+    while ((child = 2 * i + 1) < heap.size) {
+        if (child + 1 < heap.size && event_before(&heap.events[child + 1], &heap.events[child])) {
+            child++;
+        }
+        if (!event_before(&heap.events[child], &last)) {
+            break;
+        }
+        heap.events[i] = heap.events[child];
+        i = child;
+    }
+    heap.events[i] = last;
+    return 0;
+}
+
+//Build packet seq from sender_id to receiver_id and put it on the link to the router
+void sim_transmit(unsigned int sender_id, unsigned int receiver_id, unsigned int seq) {
+    struct msg_payload *pkt;
+    int slot;
+
+    if ((slot = pool_alloc(&router.pool)) == -1) {
+        router.pool_drops++;
+        return;
+    }
+    pkt = POOL_PKT(&router.pool, slot);
+    pkt->seq = htonl(seq);
+    pkt->sender_id = htonl(sender_id);
+    pkt->receiver_id = htonl(receiver_id);
+    msg_set_len(pkt, payload_len);
+    msg_stamp(pkt, sim_now);
+    sim_schedule(sim_now + link_ns, EV_ROUTER_ARRIVE, slot, NULL);
+}
+
+//Router: queue an arriving packet for its destination, as router_enqueue() does
+void router_arrive(unsigned int slot) {
+    unsigned int host_recv_id, q_index = 0;
+    struct msg_payload *pkt = POOL_PKT(&router.pool, slot);
+
+    router.rcvd++;
+    router.rx_bytes += msg_len(pkt);
+    host_recv_id = ntohl(pkt->receiver_id);
+    if (host_recv_id < 1 || host_recv_id > router.n_dest) {
+        router.unroutable++;
+        pool_free(&router.pool, slot);
+        return;
+    }
+    if (router.q_amount > 1) {
+        q_index = host_recv_id - 1;
+        if (q_index >= router.q_amount) {
+            router.unroutable++;
+            pool_free(&router.pool, slot);
+            return;
+        }
+    }
+    if (aqm_enqueue(&router.aqms[q_index], slot, &router.queues[q_index], router.max_q_size, &router.pool, sim_now) != 0) {
+        pool_free(&router.pool, slot);
+    }
+}
+
+//Router: dequeue one packet and put it on the link to its receiver, as
+//router_service() does. Returns 0 if every queue was empty.
+int router_service(void) {
+    int q_index, slot;
+    struct router_q *q;
+
+    do {
+        if ((q_index = router.sched.pick(&router.sched, router.queues)) == -1) {
+            return 0;
+        }
+        q = &router.queues[q_index];
+        slot = aqm_dequeue(&router.aqms[q_index], q, &router.pool, sim_now);
+    } while (slot == -1);
+    sched_charge(&router.sched, q_index, msg_len(POOL_PKT(&router.pool, slot)));
+    hist_record(&router.occupancy[q_index], q->q_size);
+    router.sent++;
+    router.tx_bytes += msg_len(POOL_PKT(&router.pool, slot));
+    sim_schedule(sim_now + link_ns, EV_RX_ARRIVE, slot, NULL);
+    return 1;
+}
+
+//Count a packet delivered to a receiver and free its buffer
+void receiver_deliver(struct sim_receiver *rx, unsigned int slot) {
+    struct msg_payload *pkt = POOL_PKT(&router.pool, slot);
+
+    rx->rcvd++;
+    rx->bytes += msg_len(pkt);
+    hist_record(&rx->delay, elapsed_ns(msg_timestamp_ns(pkt), sim_now));
+}
+
+//Receiver 2: send an ACK for the window back to Sender 2
+void r2_send_ack(void) {
+    struct ack_payload *ack = malloc(sizeof (struct ack_payload));
+
+    if (ack == NULL) {
+        return;
+    }
+    ack_build(ack, &r2.window, r2.last_echo_ns, elapsed_ns(r2.last_arrival_time, sim_now));
+    r2.acks_sent++;
+    r2.unacked_cnt = 0;
+    r2.ack_gen++; //the pending delayed ACK timer is no longer needed
+    sim_schedule(sim_now + link_ns, EV_S2_ACK, 0, ack);
+}
+
+//Receiver 2: process one datagram read from the socket, as receiver2.c does
+void r2_process(unsigned int slot) {
+    struct msg_payload *pkt = POOL_PKT(&router.pool, slot);
+    unsigned int seq = ntohl(pkt->seq), prev_seq_no;
+    int is_new = 0;
+
+    receiver_deliver(&r2.rx, slot);
+    if (seq - r2.next_seq_no < r2.slide_window_size) {
+        is_new = seqw_set(&r2.window, seq) == 1;
+    }
+    prev_seq_no = r2.next_seq_no;
+    seqw_advance(&r2.window);
+    r2.next_seq_no = r2.window.base;
+    r2.last_echo_ns = msg_timestamp_ns(pkt);
+    r2.last_arrival_time = sim_now;
+    pool_free(&router.pool, slot);
+    if (r2.unacked_cnt++ == 0) {
+        sim_schedule(sim_now + r2.ack_delay_ns, EV_R2_ACK_TIMER, ++r2.ack_gen, NULL);
+    }
+    if (ack_due(is_new, seq, prev_seq_no, r2.next_seq_no, r2.unacked_cnt, r2.ack_every)) {
+        r2_send_ack();
+    }
+}
+
+//Receiver 2: one pass of its loop. It reads at most one datagram, then waits a
+//uniform [0, b] ms as uniform_delay() does, where b is 0 for the first 5
+//seconds and then alternates between 15 and 5 every 5 seconds. With b = 0 and
+//nothing to read the loop waits for the next datagram.
+void r2_poll(void) {
+    uint64_t period = sim_now / SIM_B_PERIOD_NS, delay_ms;
+    unsigned int b = period == 0 ? 0 : (period % 2 ? 15 : 5);
+    int slot;
+
+    if ((slot = dequeue(&r2.sockbuf)) != -1) {
+        r2_process(slot);
+    }
+    delay_ms = xoshiro_next(r2.rng) % (b + 1);
+    if (b == 0 && r2.sockbuf.q_size == 0) {
+        r2.idle = 1;
+        return;
+    }
+    sim_schedule(sim_now + delay_ms * ONE_MILLION, EV_R2_POLL, 0, NULL);
+}
+
+//A packet reaches its receiver
+void rx_arrive(unsigned int slot) {
+    unsigned int receiver_id = ntohl(POOL_PKT(&router.pool, slot)->receiver_id);
+
+    if (receiver_id == 1) {
+        receiver_deliver(&r1, slot);
+        pool_free(&router.pool, slot);
+    } else if (receiver_id == 2) {
+        if (enqueue(slot, &r2.sockbuf, r2.sockbuf.capacity) != 0) {
+            r2.sockbuf_drops++;
+            pool_free(&router.pool, slot);
+            return;
+        }
+        if (r2.idle) {
+            r2.idle = 0;
+            r2_poll();
+        }
+    } else {
+        pool_free(&router.pool, slot);
+    }
+}
+
+//Sender 1: send on every pacer event during the sending periods, which last
+//on_ns and are separated by SIM_OFF_NS pauses, the first one included
+void s1_send(void) {
+    if (sim_now >= s1.on_end_ns) {
+        s1.pacer.next_ns = s1.on_end_ns + SIM_OFF_NS;
+        s1.on_end_ns = s1.pacer.next_ns + s1.on_ns;
+    } else {
+        sim_transmit(1, 1, s1.seq++);
+        s1.sent++;
+        pacer_advance(&s1.pacer, sim_now);
+    }
+    sim_schedule(s1.pacer.next_ns, EV_S1_SEND, 0, NULL);
+}
+
+//Sender 2: send every packet that is due and handle expired timers, as one
+//pass of sender2.c's main loop does, then schedule the next wake-up
+void s2_run(void) {
+    uint64_t rto_ns, wake = UINT64_MAX;
+    int rtx_slot, had_loss = 0;
+    unsigned int seq;
+
+    rto_ns = s2.timeout_time * ONE_MILLION > RTX_TICK_NS ? (uint64_t)(s2.timeout_time * ONE_MILLION) : RTX_TICK_NS;
+    if (s2.arq_mode == ARQ_SR) {
+        while ((rtx_slot = tw_expire(&s2.sr.rtx_wheel, sim_now)) != -1) {
+            seq = s2.sr.acked.base + ((rtx_slot - s2.sr.acked.base) & s2.sr.acked.mask);
+            sim_transmit(2, 2, seq);
+            sr_arm(&s2.sr, seq, rto_ns, 1, sim_now);
+            s2.sr.retransmits++;
+            s2.total_pkts_sent++;
+            had_loss = 1;
+        }
+        if (had_loss) {
+            cc_on_loss(&s2.cc, sim_now);
+            s2.slide_window_size = cc_window(&s2.cc);
+        }
+        while (s2.next_seq_no < s2.beg_seq_no + s2.slide_window_size && pacer_due(&s2.pacer, sim_now)) {
+            sim_transmit(2, 2, s2.next_seq_no);
+            sr_arm(&s2.sr, s2.next_seq_no, rto_ns, 0, sim_now);
+            s2.total_pkts_sent++;
+            s2.next_seq_no++;
+            pacer_advance(&s2.pacer, sim_now);
+        }
+        if (s2.next_seq_no < s2.beg_seq_no + s2.slide_window_size) {
+            wake = s2.pacer.next_ns;
+        }
+        if (s2.sr.rtx_wheel.armed_cnt > 0 && s2.sr.rtx_wheel.cur_tick * RTX_TICK_NS < wake) {
+            wake = s2.sr.rtx_wheel.cur_tick * RTX_TICK_NS;
+        }
+    } else {
+        if (gbn_on_timeout(&s2.gbn, &s2.cc, s2.beg_seq_no, &s2.next_seq_no, rto_ns, sim_now)) {
+            s2.slide_window_size = cc_window(&s2.cc);
+        }
+        while (s2.next_seq_no < s2.beg_seq_no + s2.slide_window_size && pacer_due(&s2.pacer, sim_now)) {
+            sim_transmit(2, 2, s2.next_seq_no);
+            gbn_sent(&s2.gbn, s2.next_seq_no, sim_now);
+            s2.total_pkts_sent++;
+            pacer_advance(&s2.pacer, sim_now);
+            s2.next_seq_no++;
+        }
+        if (s2.next_seq_no < s2.beg_seq_no + s2.slide_window_size) {
+            wake = s2.pacer.next_ns;
+        }
+        if (s2.next_seq_no != s2.beg_seq_no && gbn_deadline(&s2.gbn, s2.beg_seq_no, rto_ns) < wake) {
+            wake = gbn_deadline(&s2.gbn, s2.beg_seq_no, rto_ns);
+        }
+    }
+    s2.wake_gen++;
+    if (wake < sim_end) {
+        sim_schedule(wake > sim_now ? wake : sim_now, EV_S2_WAKE, s2.wake_gen, NULL);
+    }
+}
+
+//Sender 2: process one ACK, as sender2.c does for every ACK it reads
+void s2_ack(struct ack_payload *ack) {
+    unsigned int ack_seq = ntohl(ack->cum_ack), prev_beg_seq_no;
+    uint64_t rtt_ns;
+    double current_rtt;
+
+    s2.ack_pkt_cnt++;
+    rtt_ns = elapsed_ns(be64toh(ack->echo_ns) + ntohl(ack->ack_delay_ns), sim_now);
+    hist_record(&s2.rtt_hist, rtt_ns);
+    current_rtt = rtt_ns / (double)ONE_MILLION;
+    if (s2.ack_pkt_cnt == 1) {
+        s2.avg_rtt = current_rtt;
+        s2.avg_dev = current_rtt;
+    } else if (s2.arq_mode == ARQ_SR) {
+        s2.avg_rtt = avg_round_trip_time(s2.avg_rtt, current_rtt, 0.125);
+        s2.avg_dev = avg_deviation(s2.avg_dev, current_rtt, s2.avg_rtt, 0.25);
+    } else {
+        s2.avg_rtt = avg_round_trip_time(s2.avg_rtt, current_rtt, 0.875);
+        s2.avg_dev = avg_deviation(s2.avg_dev, current_rtt, s2.avg_rtt, 0.75);
+    }
+    s2.timeout_time = timeout(s2.avg_rtt, s2.avg_dev);
+    if (s2.arq_mode == ARQ_SR) {
+        prev_beg_seq_no = s2.beg_seq_no;
+        s2.beg_seq_no = sr_on_ack(&s2.sr, ack_seq, ack->sack, s2.next_seq_no);
+        if (s2.beg_seq_no > prev_beg_seq_no) {
+            cc_on_ack(&s2.cc, s2.beg_seq_no - prev_beg_seq_no, rtt_ns, sim_now);
+            s2.slide_window_size = cc_window(&s2.cc);
+        }
+    } else {
+        gbn_on_ack(&s2.gbn, &s2.cc, ack_seq, &s2.beg_seq_no, &s2.next_seq_no, rtt_ns, sim_now);
+        s2.slide_window_size = cc_window(&s2.cc);
+    }
+    free(ack);
+    s2_run();
+}
+
+//Set up the router with q_amount queues of max_q_size packets. Returns 0 on
+//success, -1 if memory could not be allocated or a name is unknown.
+int router_init(unsigned int q_amount, double dq_time, unsigned int max_q_size, const char *sched_name, unsigned int quantum, const char *aqm_name, unsigned int pool_size) {
+    unsigned int i;
+
+    router.q_amount = q_amount;
+    router.max_q_size = max_q_size;
+    router.n_dest = q_amount > 2 ? q_amount : 2;
+    router.dq_ns = (uint64_t)(dq_time * ONE_MILLION);
+    router.queues = calloc(q_amount, sizeof (struct router_q));
+    router.aqms = calloc(q_amount, sizeof (struct aqm));
+    router.occupancy = calloc(q_amount, sizeof (struct latency_hist));
+    if (router.queues == NULL || router.aqms == NULL || router.occupancy == NULL
+        || pool_init(&router.pool, pool_size) == -1) {
+        return -1;
+    }
+    for (i = 0; i < q_amount; i++) {
+        if (router_q_init(&router.queues[i], max_q_size) == -1 || aqm_init(&router.aqms[i], aqm_name, max_q_size) == -1) {
+            return -1;
+        }
+        hist_init(&router.occupancy[i]);
+    }
+    return sched_init(&router.sched, sched_name, q_amount, quantum, &router.pool);
+}
+
+void print_csv_header(void) {
+    printf("seed,sim_sec,q_amount,dq_time_ms,max_q_size,scheduler,aqm,r1_ms,r2_ms,window,cc,arq,payload_bytes,"
+           "s1_sent,s2_sent,s2_acks,s2_goodput_pps,s2_retransmits,router_rcvd,router_sent,q1_drops,q2_drops,"
+           "r1_rcvd,r1_delay_p50_ns,r1_delay_p99_ns,r2_rcvd,r2_delay_p50_ns,r2_delay_p99_ns,s2_rtt_p50_ns,s2_rtt_p99_ns\n");
+}
+
+int main(int argc, char *argv[]) {
+    //Variables used for input arguments
+    double sim_sec = 60, dq_time = 1, on_sec = 10;
+    unsigned int q_amount = 2, max_q_size = 100, quantum = 0, window = 32;
+    char *sched_name = "strict", *aqm_name = "none", *cc_name = "none", *arq_name = "gbn";
+    unsigned long long seed = 1;
+    unsigned int ack_every = 2;
+    double ack_delay_us = 2000, link_delay_us = 20;
+    unsigned int rcvbuf_pkts = 256;
+    int csv = 0, opt;
+
+    //Variables used for running the simulation
+    struct sim_event ev;
+    struct timespec wall_start, wall_end;
+    double wall_sec, goodput;
+    unsigned int i;
+    char label[64];
+
+    s1.r = 10;
+    s2.r = 10;
+    while ((opt = getopt(argc, argv, "t:s:n:d:m:S:q:a:p:o:P:w:c:M:k:D:l:L:B:CH")) != -1) {
+        switch (opt) {
+            case 't':
+                sim_sec = strtod(optarg, NULL);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'n':
+                q_amount = atoi(optarg);
+                break;
+            case 'd':
+                dq_time = strtod(optarg, NULL);
+                break;
+            case 'm':
+                max_q_size = atoi(optarg);
+                break;
+            case 'S':
+                sched_name = optarg;
+                break;
+            case 'q':
+                quantum = atoi(optarg);
+                break;
+            case 'a':
+                aqm_name = optarg;
+                break;
+            case 'p':
+                s1.r = strtod(optarg, NULL);
+                break;
+            case 'o':
+                on_sec = strtod(optarg, NULL);
+                break;
+            case 'P':
+                s2.r = strtod(optarg, NULL);
+                break;
+            case 'w':
+                window = atoi(optarg);
+                break;
+            case 'c':
+                cc_name = optarg;
+                break;
+            case 'M':
+                arq_name = optarg;
+                break;
+            case 'k':
+                ack_every = atoi(optarg) > 0 ? atoi(optarg) : 1;
+                break;
+            case 'D':
+                ack_delay_us = strtod(optarg, NULL);
+                break;
+            case 'l':
+                if ((opt = msg_parse_payload(optarg)) == -1) {
+                    fprintf(stderr, "Sim: payload size must be between 0 and %lu bytes\n", (unsigned long)MSG_MAX_PAYLOAD);
+                    return 1;
+                }
+                payload_len = opt;
+                break;
+            case 'L':
+                link_delay_us = strtod(optarg, NULL);
+                break;
+            case 'B':
+                rcvbuf_pkts = atoi(optarg);
+                break;
+            case 'C':
+                csv = 1;
+                break;
+            case 'H':
+                print_csv_header();
+                return 0;
+            default:
+                fprintf(stderr, "Usage: %s [-t sim_sec] [-s seed] [-n q_amount] [-d dq_time_ms] [-m max_q_size] [-S strict|rr|drr] [-q quantum] [-a none|red|codel] "
+                        "[-p r1_ms] [-o on_sec] [-P r2_ms] [-w window_size] [-c none|aimd|reno|cubic|delay] [-M gbn|sr] [-k ack_every] [-D ack_delay_us] "
+                        "[-l payload_bytes] [-L link_delay_us] [-B rcvbuf_pkts] [-C] [-H]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 0) {
+        perror("Sim: incorrect number of command-line arguments\n");
+        return 1;
+    }
+    if (sim_sec <= 0 || q_amount < 1 || max_q_size < 1 || dq_time < 0 || rcvbuf_pkts < 1
+        || window < MIN_WINDOW_SIZE || window > MAX_WINDOW_SIZE || s1.r < 0 || s2.r < 0) {
+        fprintf(stderr, "Sim: invalid argument value\n");
+        return 1;
+    }
+    if (strcmp(arq_name, "gbn") == 0) {
+        s2.arq_mode = ARQ_GBN;
+    } else if (strcmp(arq_name, "sr") == 0) {
+        s2.arq_mode = ARQ_SR;
+    } else {
+        fprintf(stderr, "Sim: unknown ARQ mode %s\n", arq_name);
+        return 1;
+    }
+
+    //Every packet buffer is allocated up front: each router queue, Receiver 2's
+    //socket buffer and Sender 2's largest window can be full at once
+    if (router_init(q_amount, dq_time, max_q_size, sched_name, quantum, aqm_name,
+                    q_amount * max_q_size + rcvbuf_pkts + 2 * MAX_WINDOW_SIZE + SIM_POOL_SLACK) == -1) {
+        fprintf(stderr, "Sim: unable to set up the router (unknown scheduler or AQM policy?)\n");
+        return 2;
+    }
+    if (cc_init(&s2.cc, cc_name, window, MIN_WINDOW_SIZE, MAX_WINDOW_SIZE) == -1) {
+        fprintf(stderr, "Sim: unknown congestion controller %s\n", cc_name);
+        return 1;
+    }
+    if (router_q_init(&r2.sockbuf, rcvbuf_pkts) == -1 || seqw_init(&r2.window, window) == -1
+        || (s2.arq_mode == ARQ_SR && sr_init(&s2.sr, MAX_WINDOW_SIZE, 0) == -1)
+        || (s2.arq_mode == ARQ_GBN && gbn_init(&s2.gbn) == -1)) {
+        perror("Sim: out of memory\n");
+        return 2;
+    }
+    srand(seed); //RED's drop decisions
+    sim_end = (uint64_t)(sim_sec * ONE_BILLION);
+    link_ns = (uint64_t)(link_delay_us * 1000);
+    hist_init(&r1.delay);
+    hist_init(&r2.rx.delay);
+    hist_init(&s2.rtt_hist);
+    xoshiro_seed(r2.rng, seed ^ 0x7232ULL);
+    r2.slide_window_size = window;
+    r2.ack_every = ack_every;
+    r2.ack_delay_ns = (uint64_t)(ack_delay_us * 1000);
+    r2.idle = 1;
+
+    //Sender 1 starts sending after its first 5 second pause, Sender 2 at once
+    //with the initial timeout set to r, as sender2.c does
+    if (s1.r > 0) {
+        pacer_init(&s1.pacer, s1.r, seed ^ 0x5131ULL);
+        s1.on_ns = (uint64_t)(on_sec * ONE_BILLION);
+        s1.pacer.next_ns = SIM_OFF_NS;
+        s1.on_end_ns = SIM_OFF_NS + s1.on_ns;
+        sim_schedule(s1.pacer.next_ns, EV_S1_SEND, 0, NULL);
+    }
+    if (s2.r > 0) {
+        pacer_init(&s2.pacer, s2.r, seed ^ 0x5232ULL);
+        s2.pacer.next_ns = 0;
+        s2.slide_window_size = window;
+        s2.timeout_time = s2.r;
+        sim_schedule(0, EV_S2_WAKE, s2.wake_gen, NULL);
+    }
+    if (router.dq_ns > 0) {
+        sim_schedule(router.dq_ns, EV_ROUTER_SERVICE, 0, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+    while (sim_next(&ev) == 0 && ev.time < sim_end) {
+        sim_now = ev.time;
+        n_events++;
+        switch (ev.type) {
+            case EV_S1_SEND:
+                s1_send();
+                break;
+            case EV_S2_WAKE:
+                if (ev.arg == s2.wake_gen) {
+                    s2_run();
+                }
+                break;
+            case EV_S2_ACK:
+                s2_ack(ev.ack);
+                break;
+            case EV_ROUTER_ARRIVE:
+                router_arrive(ev.arg);
+                //a dq_time of 0 forwards every packet at once
+                if (router.dq_ns == 0) {
+                    router_service();
+                }
+                break;
+            case EV_ROUTER_SERVICE:
+                router_service();
+                sim_schedule(sim_now + router.dq_ns, EV_ROUTER_SERVICE, 0, NULL);
+                break;
+            case EV_RX_ARRIVE:
+                rx_arrive(ev.arg);
+                break;
+            case EV_R2_POLL:
+                r2_poll();
+                break;
+            case EV_R2_ACK_TIMER:
+                if (ev.arg == r2.ack_gen && r2.unacked_cnt > 0) {
+                    r2_send_ack();
+                }
+                break;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    wall_sec = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+    //goodput counts each packet once, when the window moves past it
+    goodput = s2.beg_seq_no / (sim_end / (double)ONE_BILLION);
+
+    if (csv) {
+        printf("%llu,%g,%u,%g,%u,%s,%s,%g,%g,%u,%s,%s,%u,%lu,%u,%u,%.1f,%lu,%lu,%lu,%u,%u,%lu,%llu,%llu,%lu,%llu,%llu,%llu,%llu\n",
+               seed, sim_sec, q_amount, dq_time, max_q_size, router.sched.name, aqm_name, s1.r, s2.r, window, s2.cc.name, arq_name, payload_len,
+               s1.sent, s2.total_pkts_sent, s2.ack_pkt_cnt, goodput, s2.arq_mode == ARQ_SR ? s2.sr.retransmits : s2.gbn.retransmits, router.rcvd, router.sent,
+               router.queues[0].drop_cnt, q_amount > 1 ? router.queues[1].drop_cnt : 0,
+               r1.rcvd, (unsigned long long)hist_percentile(&r1.delay, 50.0), (unsigned long long)hist_percentile(&r1.delay, 99.0),
+               r2.rx.rcvd, (unsigned long long)hist_percentile(&r2.rx.delay, 50.0), (unsigned long long)hist_percentile(&r2.rx.delay, 99.0),
+               (unsigned long long)hist_percentile(&s2.rtt_hist, 50.0), (unsigned long long)hist_percentile(&s2.rtt_hist, 99.0));
+        return 0;
+    }
+    printf("Sim: %g sec simulated in %.3f sec (%.0fx real time), %lu events, seed %llu\n",
+           sim_sec, wall_sec, wall_sec > 0 ? sim_sec / wall_sec : 0.0, n_events, seed);
+    printf("Sender 1 stats: sent %lu pkts\n", s1.sent);
+    printf("Sender 2 stats: sent %u pkts | received %u ACKs\n", s2.total_pkts_sent, s2.ack_pkt_cnt);
+    printf("Sender 2 stats: congestion control %s | final window %u pkts | goodput %.1f pkts/sec\n",
+           s2.cc.name, s2.slide_window_size, goodput);
+    if (s2.rtt_hist.total_count > 0) {
+        printf("Sender 2 stats: queueing delay p50 %llu nsec | p99 %llu nsec\n",
+               (unsigned long long)(hist_percentile(&s2.rtt_hist, 50.0) - s2.rtt_hist.min),
+               (unsigned long long)(hist_percentile(&s2.rtt_hist, 99.0) - s2.rtt_hist.min));
+    }
+    if (s2.arq_mode == ARQ_SR) {
+        printf("Sender 2 stats: selective repeat retransmitted %lu pkts\n", s2.sr.retransmits);
+    } else {
+        printf("Sender 2 stats: go-back-n retransmitted %lu pkts\n", s2.gbn.retransmits);
+    }
+    hist_print(&s2.rtt_hist, "Sender 2 stats: RTT", "nsec");
+    printf("Router stats: received %lu pkts | sent %lu pkts | out of packet buffers %lu\n", router.rcvd, router.sent, router.pool_drops);
+    printf("Router stats: received %lu bytes | forwarded %lu bytes (%.1f bytes/pkt)\n",
+           router.rx_bytes, router.tx_bytes, router.sent ? (double)router.tx_bytes / router.sent : 0.0);
+    printf("Router stats: scheduler %s | unroutable pkts %lu\n", router.sched.name, router.unroutable);
+    for (i = 0; i < q_amount; i++) {
+        printf("Router stats: Q%u drop count %u\n", i + 1, router.queues[i].drop_cnt);
+        snprintf(label, sizeof label, "Router stats: Q%u queue size", i + 1);
+        hist_print(&router.occupancy[i], label, "pkts");
+        if (router.aqms[i].policy == AQM_RED) {
+            printf("Router stats: Q%u AQM red | early drops %lu | forced drops %lu | avg queue %.2f\n",
+                   i + 1, router.aqms[i].red_early_drops, router.aqms[i].red_forced_drops, router.aqms[i].avg_q);
+        } else if (router.aqms[i].policy == AQM_CODEL) {
+            printf("Router stats: Q%u AQM codel | drops %lu\n", i + 1, router.aqms[i].codel_drops);
+        }
+    }
+    printf("Receiver 1 stats: received %lu pkts (%lu bytes)\n", r1.rcvd, r1.bytes);
+    hist_print(&r1.delay, "Receiver stats: packet delay", "nsec");
+    printf("Receiver 2 stats: received %lu pkts (%lu bytes) | sent %lu ACKs (%.2f pkts/ACK) | socket buffer drops %lu\n",
+           r2.rx.rcvd, r2.rx.bytes, r2.acks_sent, r2.acks_sent ? (double)r2.rx.rcvd / r2.acks_sent : 0.0, r2.sockbuf_drops);
+    hist_print(&r2.rx.delay, "Receiver stats: packet delay", "nsec");
+    return 0;
+}
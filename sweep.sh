@@ -0,0 +1,224 @@
+#!/bin/bash
+# EE122 Project 2 - sweep.sh
+# Xiaodian (Yinyin) Wang and Arnab Mukherji
+#
+# sweep.sh runs every point of a parameter grid, in parallel on all cores, and
+# collects one result row per point into a single CSV (or JSON) table.
+# By default each point is a run of the simulator (sim -C). With -m live the
+# point runs the real router, receivers and senders on loopback for -t
+# seconds, each point in its own network namespace so the fixed ports of
+# concurrent runs do not collide (needs root).
+#
+# Usage: ./sweep.sh [-m sim|live] [-j jobs] [-t seconds] [-o out_file] [-J] param=v1,v2,... ...
+# -m sim|live picks the simulator (the default) or the live binaries
+# -j jobs is the number of points run at once [number of cores]
+# -t seconds is the simulated, or live, time of each point [60]
+# -o out_file is where the table is written [sweep.csv, or sweep.json with -J]
+# -J writes a JSON array of objects instead of CSV
+#
+# Parameters (every combination of the listed values is run):
+#   dq      router dequeuing interval in ms [1]        (live: whole ms only)
+#   maxq    router queue size in packets [100]
+#   q       number of router queues [2]
+#   sched   router scheduler strict|rr|drr [strict]
+#   aqm     router AQM none|red|codel [none]
+#   window  Sender 2 window size [32]
+#   cc      Sender 2 congestion control none|aimd|reno|cubic|delay [none]
+#   arq     Sender 2 ARQ mode gbn|sr [gbn]
+#   r       Sender 2 mean inter-packet time in ms [10]
+#   r1      Sender 1 mean inter-packet time in ms, 0 turns it off [10]
+#   payload payload size in bytes [104]
+#   seed    simulator seed [1]                         (sim only)
+# e.g. ./sweep.sh dq=1,2,5 maxq=10,100 window=8,32,128 cc=none,aimd r=1,5,10
+
+SWEEP_PARAMS="dq maxq q sched aqm window cc arq r r1 payload seed"
+BIN_DIR=$(cd "$(dirname "$0")" && pwd)
+
+usage() {
+    echo "Usage: $0 [-m sim|live] [-j jobs] [-t seconds] [-o out_file] [-J] param=v1,v2,... ..." >&2
+    echo "Parameters: $SWEEP_PARAMS" >&2
+    exit 1
+}
+
+# Value of parameter $1 in the current point, or the default $2
+param() {
+    local v="${point[$1]}"
+    echo "${v:-$2}"
+}
+
+# Number following the word $3 on the first line of file $1 containing $2
+stat_of() {
+    grep -m1 -- "$2" "$1" | sed -n "s/.*$3 \([0-9.]*\).*/\1/p"
+}
+
+# Run the current point with the simulator, print its CSV row
+sim_point() {
+    local args=(-C -t "$duration" -s "$(param seed 1)" -n "$(param q 2)" -d "$(param dq 1)"
+                -m "$(param maxq 100)" -S "$(param sched strict)" -a "$(param aqm none)"
+                -p "$(param r1 10)" -P "$(param r 10)" -w "$(param window 32)"
+                -c "$(param cc none)" -M "$(param arq gbn)" -l "$(param payload 104)")
+
+    "$BIN_DIR/sim" "${args[@]}"
+}
+
+# Run the current point with the live binaries on loopback, print its CSV row
+# in the simulator's columns. Sender 1's sent count is not reported live.
+live_point() {
+    local dir pids s1_pid window r1 r payload
+    dir=$(mktemp -d)
+    window=$(param window 32)
+    r=$(param r 10)
+    r1=$(param r1 10)
+    payload=$(param payload 104)
+
+    ip link set lo up
+    "$BIN_DIR/router" "$(param q 2)" "$(param dq 1)" "$(param maxq 100)" -s "$(param sched strict)" -a "$(param aqm none)" \
+        > "$dir/router.out" 2>&1 &
+    pids="$!"
+    "$BIN_DIR/receiver1" 1 > "$dir/r1.out" 2>&1 &
+    pids="$pids $!"
+    "$BIN_DIR/receiver2" 2 127.0.0.1 "$window" > "$dir/r2.out" 2>&1 &
+    pids="$pids $!"
+    sleep 0.2
+    if [ "$r1" != "0" ]; then
+        "$BIN_DIR/sender1" -l "$payload" 1 "$r1" 1 127.0.0.1 "$duration" > /dev/null 2>&1 &
+        s1_pid=$!
+    fi
+    timeout -s INT "$duration" "$BIN_DIR/sender2" -m "$(param arq gbn)" -l "$payload" \
+        2 "$r" 2 127.0.0.1 "$window" "$r" "$(param cc none)" > "$dir/s2.out" 2>&1
+    # sender1 repeats its sending period until it is killed (it has no SIGINT
+    # handler, and background jobs of a script ignore SIGINT)
+    [ -n "$s1_pid" ] && kill "$s1_pid" 2> /dev/null
+    # let the queues drain before the receivers and the router print their stats
+    sleep 1
+    kill -INT $pids 2> /dev/null
+    wait
+
+    local s2_rtt r1_delay r2_delay rtx
+    rtx=$(stat_of "$dir/s2.out" retransmitted retransmitted)
+    s2_rtt="$(stat_of "$dir/s2.out" "Sender 2 stats: RTT" p50),$(stat_of "$dir/s2.out" "Sender 2 stats: RTT" p99)"
+    r1_delay="$(stat_of "$dir/r1.out" "packet delay" p50),$(stat_of "$dir/r1.out" "packet delay" p99)"
+    r2_delay="$(stat_of "$dir/r2.out" "packet delay" p50),$(stat_of "$dir/r2.out" "packet delay" p99)"
+    echo "$(param seed 1),$duration,$(param q 2),$(param dq 1),$(param maxq 100),$(param sched strict),$(param aqm none)," \
+         "$r1,$r,$window,$(param cc none),$(param arq gbn),$payload," \
+         ",$(stat_of "$dir/s2.out" "Sender 2 stats: sent" sent),$(stat_of "$dir/s2.out" "Sender 2 stats: sent" received)," \
+         "$(stat_of "$dir/s2.out" goodput goodput),${rtx:-0}," \
+         "$(stat_of "$dir/router.out" "Router stats: batch" received),$(stat_of "$dir/router.out" "Router stats: batch" sent)," \
+         "$(stat_of "$dir/router.out" "Q1 drop count" count),$(stat_of "$dir/router.out" "Q2 drop count" count)," \
+         "$(stat_of "$dir/r1.out" "Receiver 1 stats" received),$r1_delay," \
+         "$(stat_of "$dir/r2.out" "Receiver 2 stats" received),$r2_delay,$s2_rtt" | tr -d ' '
+    rm -rf "$dir"
+}
+
+# Run one point given as index param=value ..., print "index,row"
+run_point() {
+    local index=$1 kv row
+    declare -gA point
+    shift
+    for kv in "$@"; do
+        point[${kv%%=*}]=${kv#*=}
+    done
+    if [ "$mode" = "live" ]; then
+        row=$(live_point)
+    else
+        row=$(sim_point)
+    fi
+    if [ -z "$row" ]; then
+        echo "sweep.sh: point $index ($*) failed" >&2
+        return 1
+    fi
+    echo "$index,$row"
+}
+
+# Convert the CSV table on stdin to a JSON array of objects
+csv_to_json() {
+    awk -F, 'NR == 1 { n = split($0, keys, ","); print "["; next }
+             { printf "%s  {", (NR > 2 ? ",\n" : "")
+               for (i = 1; i <= n; i++) {
+                   v = $i
+                   if (v == "") v = "null"
+                   else if (v !~ /^-?[0-9]+(\.[0-9]+)?$/) v = "\"" v "\""
+                   printf "%s\"%s\": %s", (i > 1 ? ", " : ""), keys[i], v
+               }
+               printf "}" }
+             END { print "\n]" }'
+}
+
+mode=sim
+jobs=$(nproc)
+duration=60
+out=""
+json=0
+inner=0
+all_args=("$@")
+while getopts "m:j:t:o:JR" opt; do
+    case $opt in
+        m) mode=$OPTARG ;;
+        j) jobs=$OPTARG ;;
+        t) duration=$OPTARG ;;
+        o) out=$OPTARG ;;
+        J) json=1 ;;
+        R) inner=1 ;;  # internal: run the single point given as arguments
+        *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+if [ "$mode" != "sim" ] && [ "$mode" != "live" ]; then
+    usage
+fi
+
+if [ $inner -eq 1 ]; then
+    # every live point gets a private loopback, so all of them can use the fixed ports
+    if [ "$mode" = "live" ] && [ -z "$SWEEP_NETNS" ]; then
+        SWEEP_NETNS=1 exec unshare -n "$0" "${all_args[@]}"
+    fi
+    run_point "$@"
+    exit $?
+fi
+
+if [ "$mode" = "live" ] && [ "$(id -u)" -ne 0 ]; then
+    echo "sweep.sh: -m live runs each point in its own network namespace and needs root" >&2
+    exit 1
+fi
+if [ ! -x "$BIN_DIR/sim" ]; then
+    echo "sweep.sh: $BIN_DIR/sim not found, run make first" >&2
+    exit 1
+fi
+
+# Expand the grid: every point is one line of param=value words
+points=("")
+for arg in "$@"; do
+    name=${arg%%=*}
+    if [ "$name" = "$arg" ] || [[ " $SWEEP_PARAMS " != *" $name "* ]]; then
+        echo "sweep.sh: unknown parameter $arg" >&2
+        usage
+    fi
+    IFS=, read -ra values <<< "${arg#*=}"
+    expanded=()
+    for p in "${points[@]}"; do
+        for v in "${values[@]}"; do
+            expanded+=("$p $name=$v")
+        done
+    done
+    points=("${expanded[@]}")
+done
+
+if [ -z "$out" ]; then
+    out=$([ $json -eq 1 ] && echo sweep.json || echo sweep.csv)
+fi
+echo "sweep.sh: running ${#points[@]} points ($mode, $duration sec each) on $jobs cores" >&2
+start=$(date +%s)
+table=$(mktemp)
+echo "point,$("$BIN_DIR/sim" -H)" > "$table"
+for i in "${!points[@]}"; do
+    echo "$i ${points[$i]}"
+done | xargs -P "$jobs" -L 1 "$0" -R -m "$mode" -t "$duration" | sort -t, -k1,1n >> "$table"
+
+rows=$(($(wc -l < "$table") - 1))
+if [ $json -eq 1 ]; then
+    csv_to_json < "$table" > "$out"
+else
+    cp "$table" "$out"
+fi
+rm -f "$table"
+echo "sweep.sh: wrote $rows of ${#points[@]} results to $out in $(($(date +%s) - start)) sec" >&2
@@ -0,0 +1,608 @@
+// EE122 Project 2 - ubench.c
+// Xiaodian (Yinyin) Wang and Arnab Mukherji
+//
+// ubench.c is a microbenchmark of the per-packet primitives in util.c and of
+// candidate replacements for them. Every case runs a tight loop of one
+// operation in each of n threads at once (each thread on its own data unless
+// the case says otherwise) and reports nanoseconds per operation, the
+// aggregate rate, and cache misses per operation counted with
+// perf_event_open(). Queue cases are repeated over several queue depths, so
+// the working set grows from one cache line to well past the last level cache.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include "common.h"
+
+#define UB_MAX_THREADS 64
+#define UB_MAX_DEPTHS 16
+#define UB_DEFAULT_ITERS 2000000 //operations per thread and case
+#define UB_SLOW_DIV 100 //cases making a system call per operation run fewer iterations
+#define UB_PORT_IDS 64 //receiver IDs in the precomputed port table
+#define UB_POOL_MAX_DEPTH 65536 //96 MB of packet buffers per thread
+
+//Input Arguments to ubench.c (all optional):
+//-n iters is the number of operations per thread in every case [2000000]
+//-d depth[,depth...] are the queue depths of the queue cases [1,64,1024,16384,262144]
+//-t threads[,threads...] are the thread counts every case runs with [1,2,nproc]
+//-c name runs only the cases whose name contains name
+//-C prints CSV rows instead of the table
+
+struct ub_thread;
+
+//One benchmark case. run() sets up its data, calls ub_begin(), performs
+//t->iters operations, calls ub_end() and returns a value the loop computed,
+//so the compiler cannot drop the loop.
+struct ub_case {
+    const char *name;
+    int uses_depth; //repeated for every queue depth
+    unsigned int max_depth; //larger depths are skipped, 0 if there is no limit
+    int slow; //runs iters / UB_SLOW_DIV operations
+    int paired; //threads work in producer/consumer pairs sharing one ring
+    uint64_t (*run)(struct ub_thread *t);
+};
+
+struct ub_thread {
+    pthread_t tid;
+    const struct ub_case *c;
+    unsigned int index, depth;
+    unsigned long iters;
+    int perf_fd; //cache miss counter of this thread, -1 if unavailable
+    uint64_t start_ns, end_ns, elapsed_ns, misses;
+    uint64_t sink;
+    int failed; //the case could not allocate its data
+};
+
+//Power-of-two ring of pool slots indexed with free-running counters and a
+//mask: the candidate replacement for router_q, with no wrap-around branches
+//and no q_size field to keep in step with head and tail
+struct ub_mask_ring {
+    unsigned int *slots;
+    unsigned int head, tail, mask;
+};
+
+pthread_barrier_t ub_barrier;
+struct spsc_ring ub_pair_rings[UB_MAX_THREADS / 2];
+char ub_port_table[UB_PORT_IDS][8];
+
+//Open a counter of the cache misses of the calling thread, or -1. Kernel
+//time is left out if the perf_event_paranoid setting forbids counting it.
+int ub_perf_open(void) {
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fd == -1) {
+        attr.exclude_kernel = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    return fd;
+}
+
+//Start the timed region: wait for the other threads, then start the counters
+void ub_begin(struct ub_thread *t) {
+    pthread_barrier_wait(&ub_barrier);
+    if (t->perf_fd != -1) {
+        ioctl(t->perf_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(t->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    t->start_ns = now_ns();
+}
+
+//Setup of a case failed: still pass the barrier the other threads wait at
+uint64_t ub_fail(struct ub_thread *t) {
+    t->failed = 1;
+    pthread_barrier_wait(&ub_barrier);
+    return 0;
+}
+
+void ub_end(struct ub_thread *t) {
+    t->end_ns = now_ns();
+    t->elapsed_ns = elapsed_ns(t->start_ns, t->end_ns);
+    if (t->perf_fd != -1) {
+        ioctl(t->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(t->perf_fd, &t->misses, sizeof t->misses) != sizeof t->misses) {
+            t->misses = 0;
+        }
+    }
+}
+
+//router_q: one enqueue and one dequeue per operation, with depth - 1 packets
+//left in the queue, so the ring is walked through all of its entries
+uint64_t run_router_q(struct ub_thread *t) {
+    struct router_q q;
+    unsigned long i;
+    uint64_t sum = 0;
+
+    if (router_q_init(&q, t->depth) == -1) {
+        return ub_fail(t);
+    }
+    for (i = 0; i + 1 < t->depth; i++) {
+        enqueue(i, &q, t->depth);
+    }
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        enqueue(i, &q, t->depth);
+        sum += dequeue(&q);
+    }
+    ub_end(t);
+    free(q.slots);
+    return sum;
+}
+
+int ub_mask_ring_init(struct ub_mask_ring *r, unsigned int capacity) {
+    unsigned int size = 1;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+    r->slots = malloc(size * sizeof (unsigned int));
+    r->head = 0;
+    r->tail = 0;
+    r->mask = size - 1;
+    return r->slots == NULL ? -1 : 0;
+}
+
+static inline int ub_mask_enqueue(struct ub_mask_ring *r, unsigned int slot) {
+    if (r->tail - r->head > r->mask) {
+        return 1;
+    }
+    r->slots[r->tail++ & r->mask] = slot;
+    return 0;
+}
+
+static inline int ub_mask_dequeue(struct ub_mask_ring *r) {
+    if (r->head == r->tail) {
+        return -1;
+    }
+    return r->slots[r->head++ & r->mask];
+}
+
+//Masked ring: the same enqueue/dequeue pattern as run_router_q
+uint64_t run_mask_ring(struct ub_thread *t) {
+    struct ub_mask_ring r;
+    unsigned long i;
+    uint64_t sum = 0;
+
+    if (ub_mask_ring_init(&r, t->depth) == -1) {
+        return ub_fail(t);
+    }
+    for (i = 0; i + 1 < t->depth; i++) {
+        ub_mask_enqueue(&r, i);
+    }
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        ub_mask_enqueue(&r, i);
+        sum += ub_mask_dequeue(&r);
+    }
+    ub_end(t);
+    free(r.slots);
+    return sum;
+}
+
+//Packet pool with depth - 1 packets in flight: allocate a buffer, write its
+//header, and free the oldest buffer in flight after reading its header, as
+//the router does for a queue of that depth
+uint64_t run_pool(struct ub_thread *t) {
+    struct pkt_pool pool;
+    struct ub_mask_ring held;
+    unsigned long i;
+    uint64_t sum = 0;
+    int slot;
+
+    if (pool_init(&pool, t->depth) == -1 || ub_mask_ring_init(&held, t->depth) == -1) {
+        return ub_fail(t);
+    }
+    for (i = 0; i + 1 < t->depth; i++) {
+        ub_mask_enqueue(&held, pool_alloc(&pool));
+    }
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        slot = pool_alloc(&pool);
+        POOL_PKT(&pool, slot)->seq = i;
+        ub_mask_enqueue(&held, slot);
+        slot = ub_mask_dequeue(&held);
+        sum += POOL_PKT(&pool, slot)->seq;
+        pool_free(&pool, slot);
+    }
+    ub_end(t);
+    munmap(pool.pkts, pool.arena_len);
+    free(pool.free_slots);
+    free(pool.enq_ns);
+    free(held.slots);
+    return sum;
+}
+
+//spsc_ring used by a single thread: one push and one pop per operation, the
+//cost of the atomics and the entry copies without any cache line transfer
+uint64_t run_spsc_local(struct ub_thread *t) {
+    struct spsc_ring ring;
+    unsigned int entry, i;
+    uint64_t sum = 0;
+
+    if (spsc_init(&ring, t->depth, sizeof (unsigned int)) == -1) {
+        return ub_fail(t);
+    }
+    for (entry = 0; entry + 1 < t->depth; entry++) {
+        spsc_push(&ring, &entry);
+    }
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        spsc_push(&ring, &i);
+        spsc_pop(&ring, &entry);
+        sum += entry;
+    }
+    ub_end(t);
+    free(ring.entries);
+    return sum;
+}
+
+//spsc_ring between two threads: even threads push iters entries, odd threads
+//pop them, as the threaded router's ingress and egress threads do
+uint64_t run_spsc_pair(struct ub_thread *t) {
+    struct spsc_ring *ring = &ub_pair_rings[t->index / 2];
+    unsigned int i, entry;
+    uint64_t sum = 0;
+
+    ub_begin(t);
+    if (t->index % 2 == 0) {
+        for (i = 0; i < t->iters; i++) {
+            while (spsc_push(ring, &i) == -1) {
+                sched_yield(); //the consumer is behind, let it run if it shares this cpu
+            }
+        }
+    } else {
+        for (i = 0; i < t->iters; i++) {
+            while (spsc_pop(ring, &entry) == -1) {
+                sched_yield(); //the producer is behind
+            }
+            sum += entry;
+        }
+    }
+    ub_end(t);
+    return sum;
+}
+
+//uniform_delay(0): gettimeofday, srand, rand and a zero-length usleep, all
+//paid for every call even when b is 0
+uint64_t run_uniform_delay(struct ub_thread *t) {
+    unsigned long i;
+
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        uniform_delay(0);
+    }
+    ub_end(t);
+    return 0;
+}
+
+//The random draw of uniform_delay(15) without the sleep: a clock read and a
+//reseed of the process-wide rand() state on every call
+uint64_t run_uniform_draw_rand(struct ub_thread *t) {
+    struct timeval curr_time;
+    unsigned long i;
+    uint64_t sum = 0;
+
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        gettimeofday(&curr_time, NULL);
+        srand(curr_time.tv_usec);
+        sum += rand() % 16;
+    }
+    ub_end(t);
+    return sum;
+}
+
+//The same draw from a per-thread xoshiro generator seeded once
+uint64_t run_uniform_draw_xoshiro(struct ub_thread *t) {
+    uint64_t rng[4], sum = 0;
+    unsigned long i;
+
+    xoshiro_seed(rng, t->index + 1);
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        sum += xoshiro_next(rng) % 16;
+    }
+    ub_end(t);
+    return sum;
+}
+
+//The random draw of the original poisson_delay(10) without the sleep: a
+//reseed, then rand() until the running product drops below exp(-mean)
+uint64_t run_poisson_draw_rand(struct ub_thread *t) {
+    struct timeval curr_time;
+    double l = exp(-10.0), p, rand_num, sum = 0;
+    unsigned long i;
+
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        p = 1;
+        gettimeofday(&curr_time, NULL);
+        srand(curr_time.tv_usec);
+        do {
+            rand_num = rand() / (double)RAND_MAX;
+            p = p * rand_num;
+        } while (p > l);
+        sum += -log(1.0 - rand_num) * 10.0;
+    }
+    ub_end(t);
+    return (uint64_t)sum;
+}
+
+//pacer_advance(), which replaced poisson_delay in the senders
+uint64_t run_pacer_advance(struct ub_thread *t) {
+    struct pacer pacer;
+    unsigned long i;
+
+    pacer_init(&pacer, 10.0, t->index + 1);
+    pacer.next_ns = 0;
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        pacer_advance(&pacer, 0);
+    }
+    ub_end(t);
+    return pacer.next_ns;
+}
+
+//get_receiver_port(): sprintf into one global buffer shared by every caller
+uint64_t run_get_receiver_port(struct ub_thread *t) {
+    unsigned long i;
+    uint64_t sum = 0;
+
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        sum += get_receiver_port(1 + (i & 1))[3];
+    }
+    ub_end(t);
+    return sum;
+}
+
+//Replacement: format the port into a buffer owned by the caller
+char *ub_receiver_port_buf(unsigned int receiver_id, char *buf, size_t len) {
+    snprintf(buf, len, "%u", RECEIVER_PORT_BASE + (receiver_id - 1));
+    return buf;
+}
+
+uint64_t run_receiver_port_buf(struct ub_thread *t) {
+    char buf[16];
+    unsigned long i;
+    uint64_t sum = 0;
+
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        sum += ub_receiver_port_buf(1 + (i & 1), buf, sizeof buf)[3];
+    }
+    ub_end(t);
+    return sum;
+}
+
+//Replacement: look the port string up in a table filled once at startup
+uint64_t run_receiver_port_table(struct ub_thread *t) {
+    unsigned long i;
+    uint64_t sum = 0;
+
+    ub_begin(t);
+    for (i = 0; i < t->iters; i++) {
+        sum += ub_port_table[i & 1][3];
+    }
+    ub_end(t);
+    return sum;
+}
+
+const struct ub_case ub_cases[] = {
+    {"router_q enqueue+dequeue", 1, 0, 0, 0, run_router_q},
+    {"mask_ring enqueue+dequeue", 1, 0, 0, 0, run_mask_ring},
+    {"pool alloc+free", 1, UB_POOL_MAX_DEPTH, 0, 0, run_pool},
+    {"spsc push+pop (1 thread)", 1, 0, 0, 0, run_spsc_local},
+    {"spsc push->pop (thread pairs)", 1, 0, 0, 1, run_spsc_pair},
+    {"uniform_delay(0)", 0, 0, 1, 0, run_uniform_delay},
+    {"uniform draw srand+rand", 0, 0, 0, 0, run_uniform_draw_rand},
+    {"uniform draw xoshiro", 0, 0, 0, 0, run_uniform_draw_xoshiro},
+    {"poisson draw srand+rand", 0, 0, 0, 0, run_poisson_draw_rand},
+    {"poisson draw pacer_advance", 0, 0, 0, 0, run_pacer_advance},
+    {"get_receiver_port", 0, 0, 0, 0, run_get_receiver_port},
+    {"receiver port snprintf", 0, 0, 0, 0, run_receiver_port_buf},
+    {"receiver port table", 0, 0, 0, 0, run_receiver_port_table},
+};
+
+void *ub_thread_main(void *arg) {
+    struct ub_thread *t = arg;
+
+    t->sink = t->c->run(t);
+    return NULL;
+}
+
+//Run case c with n_threads threads at queue depth depth and print a result row
+void ub_run_case(const struct ub_case *c, unsigned int depth, unsigned int n_threads, unsigned long iters, int csv) {
+    struct ub_thread threads[UB_MAX_THREADS];
+    uint64_t first_start = UINT64_MAX, last_end = 0, misses = 0;
+    double ns_per_op = 0, mops, misses_per_op = -1;
+    unsigned int i, counted = 0;
+    int failed = 0;
+    char depth_str[16];
+
+    if (c->paired) {
+        n_threads += n_threads % 2;
+        for (i = 0; i < n_threads / 2; i++) {
+            if (spsc_init(&ub_pair_rings[i], depth, sizeof (unsigned int)) == -1) {
+                return;
+            }
+        }
+    }
+    if (c->slow) {
+        iters = iters / UB_SLOW_DIV > 0 ? iters / UB_SLOW_DIV : 1;
+    }
+    pthread_barrier_init(&ub_barrier, NULL, n_threads);
+    for (i = 0; i < n_threads; i++) {
+        memset(&threads[i], 0, sizeof (struct ub_thread));
+        threads[i].c = c;
+        threads[i].index = i;
+        threads[i].depth = depth;
+        threads[i].iters = iters;
+        threads[i].perf_fd = ub_perf_open();
+        pthread_create(&threads[i].tid, NULL, ub_thread_main, &threads[i]);
+    }
+    for (i = 0; i < n_threads; i++) {
+        pthread_join(threads[i].tid, NULL);
+        failed |= threads[i].failed;
+        ns_per_op += (double)threads[i].elapsed_ns / iters / n_threads;
+        if (threads[i].start_ns < first_start) {
+            first_start = threads[i].start_ns;
+        }
+        if (threads[i].end_ns > last_end) {
+            last_end = threads[i].end_ns;
+        }
+        if (threads[i].perf_fd != -1) {
+            misses += threads[i].misses;
+            counted++;
+            close(threads[i].perf_fd);
+        }
+    }
+    pthread_barrier_destroy(&ub_barrier);
+    if (c->paired) {
+        for (i = 0; i < n_threads / 2; i++) {
+            free(ub_pair_rings[i].entries);
+        }
+    }
+    if (failed) {
+        fprintf(stderr, "Ubench: %s at depth %u with %u threads: out of memory\n", c->name, depth, n_threads);
+        return;
+    }
+    //the aggregate rate is over the wall time all threads took together; a
+    //pair moves iters entries between its two threads
+    mops = (double)iters * (c->paired ? n_threads / 2 : n_threads) / elapsed_ns(first_start, last_end) * 1000.0;
+    if (counted == n_threads) {
+        misses_per_op = (double)misses / ((double)iters * n_threads);
+    }
+    if (c->uses_depth) {
+        snprintf(depth_str, sizeof depth_str, "%u", depth);
+    } else {
+        strcpy(depth_str, "-");
+    }
+    if (csv) {
+        printf("%s,%s,%u,%lu,%.2f,%.3f,", c->name, c->uses_depth ? depth_str : "", n_threads, iters, ns_per_op, mops);
+        if (misses_per_op >= 0) {
+            printf("%.4f\n", misses_per_op);
+        } else {
+            printf("\n");
+        }
+        return;
+    }
+    printf("Ubench: %-30s depth %7s | threads %2u | %9.2f ns/op | %9.3f Mops/sec | ",
+           c->name, depth_str, n_threads, ns_per_op, mops);
+    if (misses_per_op >= 0) {
+        printf("%.4f cache misses/op\n", misses_per_op);
+    } else {
+        printf("cache misses n/a\n");
+    }
+}
+
+//Parse a comma-separated list of positive numbers into list, returns the count or -1
+int ub_parse_list(char *arg, unsigned int *list, int max_len) {
+    char *tok;
+    int n = 0;
+
+    for (tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        if (n == max_len || atoi(tok) <= 0) {
+            return -1;
+        }
+        list[n++] = atoi(tok);
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned int depths[UB_MAX_DEPTHS] = {1, 64, 1024, 16384, 262144};
+    unsigned int thread_counts[UB_MAX_DEPTHS] = {1, 2};
+    int n_depths = 5, n_thread_counts = 2, csv = 0, opt, perf_fd;
+    unsigned long iters = UB_DEFAULT_ITERS;
+    char *filter = NULL;
+    unsigned int i, n_cases = sizeof ub_cases / sizeof ub_cases[0];
+    int d, t;
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n_cpus > 2) {
+        thread_counts[n_thread_counts++] = n_cpus < UB_MAX_THREADS ? n_cpus : UB_MAX_THREADS;
+    }
+    while ((opt = getopt(argc, argv, "n:d:t:c:C")) != -1) {
+        switch (opt) {
+            case 'n':
+                iters = strtoul(optarg, NULL, 0);
+                break;
+            case 'd':
+                n_depths = ub_parse_list(optarg, depths, UB_MAX_DEPTHS);
+                break;
+            case 't':
+                n_thread_counts = ub_parse_list(optarg, thread_counts, UB_MAX_DEPTHS);
+                break;
+            case 'c':
+                filter = optarg;
+                break;
+            case 'C':
+                csv = 1;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n iters] [-d depth,...] [-t threads,...] [-c case_name] [-C]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 0 || iters == 0 || n_depths <= 0 || n_thread_counts <= 0) {
+        fprintf(stderr, "Usage: %s [-n iters] [-d depth,...] [-t threads,...] [-c case_name] [-C]\n", argv[0]);
+        return 1;
+    }
+    for (t = 0; t < n_thread_counts; t++) {
+        if (thread_counts[t] > UB_MAX_THREADS) {
+            fprintf(stderr, "Ubench: at most %d threads\n", UB_MAX_THREADS);
+            return 1;
+        }
+    }
+    for (i = 0; i < UB_PORT_IDS; i++) {
+        snprintf(ub_port_table[i], sizeof ub_port_table[i], "%u", RECEIVER_PORT_BASE + i);
+    }
+
+    if (csv) {
+        printf("case,depth,threads,iters,ns_per_op,mops_per_sec,cache_misses_per_op\n");
+    } else {
+        perf_fd = ub_perf_open();
+        printf("Ubench: %lu operations per thread, %ld cpus, cache miss counters %s\n",
+               iters, n_cpus, perf_fd == -1 ? "unavailable (perf_event_open failed)" : "on");
+        if (perf_fd != -1) {
+            close(perf_fd);
+        }
+    }
+    for (i = 0; i < n_cases; i++) {
+        if (filter != NULL && strstr(ub_cases[i].name, filter) == NULL) {
+            continue;
+        }
+        for (t = 0; t < n_thread_counts; t++) {
+            if (!ub_cases[i].uses_depth) {
+                ub_run_case(&ub_cases[i], 1, thread_counts[t], iters, csv);
+                continue;
+            }
+            for (d = 0; d < n_depths; d++) {
+                if (ub_cases[i].max_depth != 0 && depths[d] > ub_cases[i].max_depth) {
+                    continue;
+                }
+                ub_run_case(&ub_cases[i], depths[d], thread_counts[t], iters, csv);
+            }
+        }
+    }
+    return 0;
+}
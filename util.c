@@ -3,6 +3,7 @@
 //
 // util.c contains all of the common functions that are used by the senders, router and receivers.
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -16,7 +17,11 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include <math.h>
+#include <endian.h>
 #include "common.h"
 
 //Get the socket address, IPv6 or IPv6 (taken from Beej's guide)
@@ -28,84 +33,645 @@ void *get_in_addr(struct sockaddr *sa) {
     return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
-//Enqueue packets to linked list
-int enqueue (struct q_elem *elem, struct router_q *q, unsigned int max_q_size) {
-    if (q->q_size >= max_q_size) {//If queue size is at max, drop incoming packets
+//Map len bytes of zeroed memory for a packet arena. Explicit 2 MB huge pages
+//are tried first, which keeps the whole arena in a few TLB entries; without
+//them (none reserved in /proc/sys/vm/nr_hugepages) ordinary pages are used and
+//transparent huge pages requested. The pages are touched up front so the
+//packet path never takes a page fault. Sets *mapped to the mapped length and
+//*huge if huge pages were used. Returns NULL on failure.
+void *arena_map (size_t len, size_t *mapped, int *huge) {
+    size_t huge_len = (len + ARENA_HUGE_PAGE_SIZE - 1) & ~(size_t)(ARENA_HUGE_PAGE_SIZE - 1);
+    size_t page = sysconf(_SC_PAGESIZE);
+    void *arena;
+
+    arena = mmap(NULL, huge_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+    if (arena != MAP_FAILED) {
+        *mapped = huge_len;
+        *huge = 1;
+        return arena;
+    }
+    *mapped = (len + page - 1) & ~(page - 1);
+    *huge = 0;
+    arena = mmap(NULL, *mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena == MAP_FAILED) {
+        return NULL;
+    }
+    //ask for huge pages before the first touch faults the memory in
+    madvise(arena, *mapped, MADV_HUGEPAGE);
+    memset(arena, 0, *mapped);
+    return arena;
+}
+
+//Allocate a pool of capacity packet buffers, all of them initially free.
+//Returns 0 on success and -1 if the memory could not be allocated.
+int pool_init (struct pkt_pool *pool, unsigned int capacity) {
+    unsigned int i;
+
+    memset(pool, 0, sizeof (struct pkt_pool));
+    pool->pkts = arena_map((size_t)capacity * sizeof (struct msg_payload), &pool->arena_len, &pool->arena_huge);
+    pool->free_slots = malloc(capacity * sizeof (unsigned int));
+    pool->enq_ns = calloc(capacity, sizeof (uint64_t));
+    if (pool->pkts == NULL || pool->free_slots == NULL || pool->enq_ns == NULL) {
+        return -1;
+    }
+    //Hand out the lowest slots first so a lightly loaded router touches few cache lines
+    for (i = 0; i < capacity; i++) {
+        pool->free_slots[i] = capacity - 1 - i;
+    }
+    pool->free_cnt = capacity;
+    pool->capacity = capacity;
+    return 0;
+}
+
+//Set up view as a pool over count slots of another pool's arena, starting at
+//slot first. The slot numbers stay those of the arena, so a packet can be
+//handed between threads as its slot index alone. Returns 0 on success, -1 on
+//allocation failure.
+int pool_init_view (struct pkt_pool *view, struct pkt_pool *arena, unsigned int first, unsigned int count) {
+    unsigned int i;
+
+    memset(view, 0, sizeof (struct pkt_pool));
+    view->pkts = arena->pkts;
+    view->enq_ns = arena->enq_ns;
+    view->free_slots = malloc(count * sizeof (unsigned int));
+    if (view->free_slots == NULL) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        view->free_slots[i] = first + count - 1 - i;
+    }
+    view->free_cnt = count;
+    view->capacity = count;
+    return 0;
+}
+
+//Take a free packet buffer from the pool, returns its slot or -1 if the pool is empty
+int pool_alloc (struct pkt_pool *pool) {
+    if (pool->free_cnt == 0) {
+        return -1;
+    }
+    return pool->free_slots[--pool->free_cnt];
+}
+
+//Give a packet buffer back to the pool
+void pool_free (struct pkt_pool *pool, unsigned int slot) {
+    if (pool->owner_rings != NULL) {
+        //the owner's ring holds all of its slots, so it cannot be full
+        spsc_push(&pool->owner_rings[slot / pool->slots_per_owner], &slot);
+        return;
+    }
+    pool->free_slots[pool->free_cnt++] = slot;
+}
+
+//Allocate the ring of a queue that can hold up to capacity packets
+int router_q_init (struct router_q *q, unsigned int capacity) {
+    memset(q, 0, sizeof (struct router_q));
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    q->slots = malloc(capacity * sizeof (unsigned int));
+    if (q->slots == NULL) {
+        return -1;
+    }
+    q->capacity = capacity;
+    return 0;
+}
+
+//Enqueue a packet pool slot at the tail of the ring
+int enqueue (unsigned int slot, struct router_q *q, unsigned int max_q_size) {
+    if (q->q_size >= max_q_size || q->q_size >= q->capacity) {//If queue size is at max, drop incoming packets
         q->drop_cnt++;
         return 1; 
     }
     
-    if (q->head == NULL) {
-        q->head = elem;
-    } else {
-        q->tail->next = elem;
+    q->slots[q->tail] = slot;
+    if (++q->tail == q->capacity) {
+        q->tail = 0;
     }
-    q->tail = elem; 
     q->q_size++;
-    elem->next = NULL;
     //printf("%s %d Queue size is %d\n", __func__, __LINE__, q->q_size);
     return 0; 
 }
 
-//Dequeue packets from linked list
-struct q_elem *dequeue (struct router_q *q) {
-    struct q_elem *elem = NULL;
+//Dequeue the packet pool slot at the head of the ring, returns -1 if the queue is empty
+int dequeue (struct router_q *q) {
+    unsigned int slot;
     //printf("%s %d Queue size is %d\n", __func__, __LINE__, q->q_size);
-    if (q->head == NULL) {
-        return NULL;
+    if (q->q_size == 0) {
+        return -1;
+    }
+    slot = q->slots[q->head];
+    if (++q->head == q->capacity) {
+        q->head = 0;
+    }
+    q->q_size--;
+    return slot; 
+}
+
+//Allocate a single-producer/single-consumer ring that holds at least capacity
+//entries of entry_size bytes. Returns 0 on success, -1 on allocation failure.
+int spsc_init (struct spsc_ring *ring, unsigned int capacity, unsigned int entry_size) {
+    unsigned int size = 1;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+    memset(ring, 0, sizeof (struct spsc_ring));
+    ring->entries = malloc((size_t)size * entry_size);
+    if (ring->entries == NULL) {
+        return -1;
+    }
+    ring->mask = size - 1;
+    ring->entry_size = entry_size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+//Copy an entry into the ring (producer thread only). Returns -1 if the ring is full.
+int spsc_push (struct spsc_ring *ring, const void *entry) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (tail - head > ring->mask) {
+        return -1;
+    }
+    memcpy(ring->entries + (size_t)(tail & ring->mask) * ring->entry_size, entry, ring->entry_size);
+    //publish the entry only after its bytes are written
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+//Copy the oldest entry out of the ring (consumer thread only). Returns -1 if the ring is empty.
+int spsc_pop (struct spsc_ring *ring, void *entry) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head == tail) {
+        return -1;
+    }
+    memcpy(entry, ring->entries + (size_t)(head & ring->mask) * ring->entry_size, ring->entry_size);
+    //hand the entry back to the producer only after it has been copied out
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+//Current time of the monotonic clock in nanoseconds. Unlike gettimeofday() it
+//never jumps when the wall clock is adjusted.
+uint64_t now_ns (void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * ONE_BILLION + ts.tv_nsec;
+}
+
+//Time elapsed from since to now in nanoseconds. A since in the future (a stamp
+//from another host's clock or a corrupted packet) gives 0 instead of wrapping
+//around to a huge unsigned value.
+uint64_t elapsed_ns (uint64_t since, uint64_t now) {
+    return now > since ? now - since : 0;
+}
+
+//Fill in the header version and the send timestamp ns of an outgoing packet
+void msg_stamp (struct msg_payload *msg, uint64_t ns) {
+    msg->version = MSG_VERSION;
+    msg->timestamp_ns = htobe64(ns);
+}
+
+//Send timestamp of a received packet in nanoseconds (host byte order)
+uint64_t msg_timestamp_ns (struct msg_payload *msg) {
+    return be64toh(msg->timestamp_ns);
+}
+
+//Set the payload length of an outgoing packet, at most MSG_MAX_PAYLOAD bytes
+void msg_set_len (struct msg_payload *msg, unsigned int payload_len) {
+    msg->length = htons(payload_len);
+}
+
+//Length in bytes of the whole datagram, header included, of a packet that
+//passed msg_valid() or was built with msg_set_len()
+unsigned int msg_len (struct msg_payload *msg) {
+    return MSG_HDR_LEN + ntohs(msg->length);
+}
+
+//Parse a payload size given on the command line. Returns the number of bytes,
+//or -1 if it is not a number between 0 and MSG_MAX_PAYLOAD.
+int msg_parse_payload (const char *arg) {
+    char *end;
+    long bytes = strtol(arg, &end, 10);
+
+    if (end == arg || *end != '\0' || bytes < 0 || bytes > (long)MSG_MAX_PAYLOAD) {
+        return -1;
+    }
+    return (int)bytes;
+}
+
+//Non-zero if the len bytes received are a packet in the format this build
+//understands, with a length field that matches the datagram's size
+int msg_valid (struct msg_payload *msg, int len) {
+    return len >= (int)MSG_HDR_LEN && msg->version == MSG_VERSION && MSG_HDR_LEN + ntohs(msg->length) == (unsigned int)len;
+}
+
+//Set up a token bucket that starts full. rate is in packets/s, or bytes/s in byte_mode.
+void tb_init (struct token_bucket *tb, double rate, double burst, int byte_mode) {
+    tb->rate = rate;
+    tb->burst = burst;
+    tb->tokens = burst;
+    tb->byte_mode = byte_mode;
+    tb->last_ns = now_ns();
+}
+
+//Add the tokens earned since the last refill, capped at the burst size
+void tb_refill (struct token_bucket *tb, uint64_t now) {
+    if (now > tb->last_ns) {
+        tb->tokens += tb->rate * (double)(now - tb->last_ns) / ONE_BILLION;
+        if (tb->tokens > tb->burst) {
+            tb->tokens = tb->burst;
+        }
+    }
+    tb->last_ns = now;
+}
+
+//Non-zero if the bucket allows the next packet to be sent. In byte mode any
+//positive balance is enough and a larger packet leaves the bucket in debt, so
+//packet lengths do not have to be known before the scheduler picks one.
+int tb_ready (struct token_bucket *tb) {
+    return tb->byte_mode ? tb->tokens > 0 : tb->tokens >= 1.0;
+}
+
+//Take the tokens for a packet that was sent
+void tb_consume (struct token_bucket *tb, unsigned int pkt_len) {
+    tb->tokens -= tb->byte_mode ? (double)pkt_len : 1.0;
+}
+
+//Set up a timer wheel of n_slots (rounded up to a power of 2) slots of tick_ns
+//each, for the timers 0..n_timers-1, starting at time now.
+//Returns 0 on success, -1 if memory could not be allocated.
+int tw_init (struct timer_wheel *tw, unsigned int n_slots, uint64_t tick_ns, unsigned int n_timers, uint64_t now) {
+    unsigned int size = 1, i;
+
+    while (size < n_slots) {
+        size <<= 1;
+    }
+    tw->tick_ns = tick_ns;
+    tw->cur_tick = now / tick_ns;
+    tw->mask = size - 1;
+    tw->armed_cnt = 0;
+    tw->slot_head = malloc(size * sizeof (int));
+    tw->next = malloc(n_timers * sizeof (int));
+    tw->prev = malloc(n_timers * sizeof (int));
+    tw->expiry_tick = malloc(n_timers * sizeof (uint64_t));
+    tw->armed = calloc(n_timers, 1);
+    if (tw->slot_head == NULL || tw->next == NULL || tw->prev == NULL || tw->expiry_tick == NULL || tw->armed == NULL) {
+        return -1;
+    }
+    for (i = 0; i < size; i++) {
+        tw->slot_head[i] = -1;
+    }
+    return 0;
+}
+
+//Stop timer id if it is armed
+void tw_cancel (struct timer_wheel *tw, unsigned int id) {
+    if (!tw->armed[id]) {
+        return;
+    }
+    if (tw->prev[id] == -1) {
+        tw->slot_head[tw->expiry_tick[id] & tw->mask] = tw->next[id];
     } else {
-        elem = q->head;
-        q->head = q->head->next;
-        q->q_size--;
-    }
-    if (q->head == NULL) {
-        q->tail = NULL;
-        q->q_size = 0;
-    }
-    return elem; 
-}
-
-//Packet delay time, generates a time delay according to a poisson distribution
-/*
- Because the rand() function isn't really random even when you seed random() with
-  the current time, it generates exponential numbers at poisson loop times. Not as
-  precise but has better "randomness" than without the looping (Otherwise you get
-  consistently very similar exponential values).
- */
-void poisson_delay(double mean) {
-    double l = 0, p = 1; 
-    double delay_time = 0, rand_num = 0;
+        tw->next[tw->prev[id]] = tw->next[id];
+    }
+    if (tw->next[id] != -1) {
+        tw->prev[tw->next[id]] = tw->prev[id];
+    }
+    tw->armed[id] = 0;
+    tw->armed_cnt--;
+}
+
+//(Re)arm timer id to fire at deadline_ns. A deadline already in the past fires
+//on the next call to tw_expire.
+void tw_arm (struct timer_wheel *tw, unsigned int id, uint64_t deadline_ns) {
+    uint64_t tick = deadline_ns / tw->tick_ns;
+    unsigned int slot;
+
+    tw_cancel(tw, id);
+    if (tick < tw->cur_tick) {
+        tick = tw->cur_tick;
+    }
+    slot = tick & tw->mask;
+    tw->expiry_tick[id] = tick;
+    tw->prev[id] = -1;
+    tw->next[id] = tw->slot_head[slot];
+    if (tw->slot_head[slot] != -1) {
+        tw->prev[tw->slot_head[slot]] = id;
+    }
+    tw->slot_head[slot] = id;
+    tw->armed[id] = 1;
+    tw->armed_cnt++;
+}
+
+//Disarm and return one timer that is due at time now, or -1 once none is left.
+//Call it in a loop until it returns -1.
+int tw_expire (struct timer_wheel *tw, uint64_t now) {
+    uint64_t now_tick = now / tw->tick_ns;
+    int id;
+
+    while (tw->cur_tick <= now_tick) {
+        if (tw->armed_cnt == 0) {
+            tw->cur_tick = now_tick + 1; //nothing to scan
+            break;
+        }
+        for (id = tw->slot_head[tw->cur_tick & tw->mask]; id != -1; id = tw->next[id]) {
+            if (tw->expiry_tick[id] <= tw->cur_tick) {
+                tw_cancel(tw, id);
+                return id;
+            }
+        }
+        tw->cur_tick++;
+    }
+    return -1;
+}
+
+//Set up an empty reorder window for at least capacity sequence numbers (rounded
+//up to a power of 2 and at least 64) starting at 0.
+//Returns 0 on success, -1 if memory could not be allocated.
+int seqw_init (struct seq_window *w, unsigned int capacity) {
+    unsigned int size = 64;
+
+    while (size < capacity) {
+        size <<= 1;
+    }
+    w->bits = calloc(size / 64, sizeof (uint64_t));
+    if (w->bits == NULL) {
+        return -1;
+    }
+    w->capacity = size;
+    w->mask = size - 1;
+    w->base = 0;
+    w->count = 0;
+    return 0;
+}
+
+//Non-zero if seq has been set. Everything below base counts as set.
+int seqw_test (struct seq_window *w, uint32_t seq) {
+    if (SEQ_LT(seq, w->base)) {
+        return 1;
+    }
+    if (seq - w->base >= w->capacity) {
+        return 0;
+    }
+    return (w->bits[(seq & w->mask) >> 6] >> (seq & 63)) & 1;
+}
+
+//Mark seq as received. Returns 1 if it is new, 0 if it was already set (or is
+//below base), -1 if it lies beyond the end of the window.
+int seqw_set (struct seq_window *w, uint32_t seq) {
+    uint64_t *word, bit;
+
+    if (SEQ_LT(seq, w->base)) {
+        return 0;
+    }
+    if (seq - w->base >= w->capacity) {
+        return -1;
+    }
+    word = &w->bits[(seq & w->mask) >> 6];
+    bit = 1ULL << (seq & 63);
+    if (*word & bit) {
+        return 0;
+    }
+    *word |= bit;
+    w->count++;
+    return 1;
+}
+
+//Move base past every set sequence number at the start of the window, clearing
+//their bits for reuse. A whole word of consecutive packets is consumed with one
+//count-trailing-zeros. Returns how far base moved.
+unsigned int seqw_advance (struct seq_window *w) {
+    unsigned int moved = 0, off, run;
+    uint64_t *word, rest;
+
+    while (w->count > 0) {
+        word = &w->bits[(w->base & w->mask) >> 6];
+        off = w->base & 63;
+        rest = ~(*word >> off); //lowest set bit of rest is the first missing seq
+        run = rest ? __builtin_ctzll(rest) : 64;
+        if (run > 64 - off) {
+            run = 64 - off;
+        }
+        if (run == 0) {
+            break;
+        }
+        *word &= ~((run == 64 ? ~0ULL : (1ULL << run) - 1) << off);
+        w->base += run;
+        w->count -= run;
+        moved += run;
+        if (off + run < 64) {
+            break; //stopped at a missing seq inside this word
+        }
+    }
+    return moved;
+}
+
+//Treat every sequence number below seq as set (a cumulative ACK) and move base
+//to seq, then past anything set right after it.
+void seqw_ack_upto (struct seq_window *w, uint32_t seq) {
+    uint64_t *word, clear;
+    unsigned int off, run;
+
+    if (SEQ_LT(seq, w->base)) {
+        return; //an old cumulative ACK
+    }
+    if (seq - w->base > w->capacity) {
+        seq = w->base + w->capacity;
+    }
+    while (SEQ_LT(w->base, seq)) {
+        word = &w->bits[(w->base & w->mask) >> 6];
+        off = w->base & 63;
+        run = 64 - off;
+        if (run > seq - w->base) {
+            run = seq - w->base;
+        }
+        clear = (run == 64 ? ~0ULL : (1ULL << run) - 1) << off;
+        w->count -= __builtin_popcountll(*word & clear);
+        *word &= ~clear;
+        w->base += run;
+    }
+    seqw_advance(w);
+}
+
+//Write the selective ACK bitmap of the window: bit i of sack (n_bits long) is
+//set if base + 1 + i has been set
+void seqw_sack (struct seq_window *w, unsigned char *sack, unsigned int n_bits) {
+    unsigned int i, found = 0;
+
+    memset(sack, 0, n_bits / 8);
+    //stop once every sequence number held beyond base has been written
+    for (i = 0; found < w->count && i < n_bits && i + 1 < w->capacity; i++) {
+        if (seqw_test(w, w->base + 1 + i)) {
+            SACK_SET(sack, i);
+            found++;
+        }
+    }
+}
+
+//Fill in a compact ACK for the receive window w, echoing the send timestamp
+//echo_ns of the newest packet it acknowledges, which was held for ack_delay_ns.
+//Trailing empty SACK bytes are not sent. Returns the length of the ACK in bytes.
+int ack_build (struct ack_payload *ack, struct seq_window *w, uint64_t echo_ns, uint64_t ack_delay_ns) {
+    unsigned int sack_len = SACK_BITS / 8;
+
+    ack->version = MSG_VERSION;
+    ack->flags = MSG_FLAG_ACK;
+    ack->cum_ack = htonl(w->base);
+    ack->echo_ns = htobe64(echo_ns);
+    ack->ack_delay_ns = htonl(ack_delay_ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ack_delay_ns);
+    seqw_sack(w, ack->sack, SACK_BITS);
+    while (sack_len > 0 && ack->sack[sack_len - 1] == 0) {
+        sack_len--;
+    }
+    ack->sack_len = htons(sack_len);
+    return ACK_HDR_LEN + sack_len;
+}
+
+//Delayed ACK policy of the receivers: non-zero if the packet seq, which moved
+//the receive window's base from prev_base to new_base, must be acknowledged at
+//once. That is when it was not new (a duplicate or beyond the window), arrived
+//out of order or filled a gap, or when unacked packets, itself included, have
+//reached ack_every. The others wait for the delayed ACK timer.
+int ack_due (int is_new, uint32_t seq, uint32_t prev_base, uint32_t new_base, unsigned int unacked, unsigned int ack_every) {
+    return !is_new || seq != prev_base || new_base - prev_base > 1 || unacked >= ack_every;
+}
+
+//Non-zero if the len bytes received are a well-formed compact ACK. The SACK
+//bytes that were not sent are cleared.
+int ack_valid (struct ack_payload *ack, int len) {
+    unsigned int sack_len;
+
+    if (len < (int)ACK_HDR_LEN || ack->version != MSG_VERSION || !(ack->flags & MSG_FLAG_ACK)) {
+        return 0;
+    }
+    sack_len = ntohs(ack->sack_len);
+    if (sack_len > sizeof ack->sack || len < (int)(ACK_HDR_LEN + sack_len)) {
+        return 0;
+    }
+    memset(ack->sack + sack_len, 0, sizeof ack->sack - sack_len);
+    return 1;
+}
+
+//xoshiro256** pseudo random number generator: four words of state per
+//generator, so every thread or pacer can own one without locking
+static inline uint64_t rotl64 (uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+uint64_t xoshiro_next (uint64_t s[4]) {
+    uint64_t result = rotl64(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl64(s[3], 45);
+    return result;
+}
+
+//Fill the generator state from a single seed with splitmix64, which never
+//produces the all-zero state xoshiro cannot leave
+void xoshiro_seed (uint64_t s[4], uint64_t seed) {
+    uint64_t z;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        s[i] = z ^ (z >> 31);
+    }
+}
+
+//Uniform random number in [0, 1) from the top 53 bits of the generator
+double xoshiro_uniform (uint64_t s[4]) {
+    return (xoshiro_next(s) >> 11) * 0x1.0p-53;
+}
+
+//Set up a pacer sending with exponentially distributed gaps of mean_ms
+//milliseconds (a Poisson process), with the first send due right away
+void pacer_init (struct pacer *p, double mean_ms, uint64_t seed) {
+    xoshiro_seed(p->rng, seed);
+    p->mean_ns = mean_ms * ONE_MILLION;
+    p->next_ns = now_ns();
+}
+
+//Non-zero if the scheduled send time has been reached
+int pacer_due (struct pacer *p, uint64_t now) {
+    return now >= p->next_ns;
+}
+
+//Schedule the next send one exponential gap after the previous scheduled send
+//time, not after now, so time spent sending does not lower the offered load. A
+//sender that fell more than PACER_MAX_BURST gaps behind (e.g. stalled on a full
+//window) starts over from now instead of bursting to catch up.
+void pacer_advance (struct pacer *p, uint64_t now) {
+    double gap = -log(1.0 - xoshiro_uniform(p->rng)) * p->mean_ns;
+
+    if (now > p->next_ns + PACER_MAX_BURST * p->mean_ns) {
+        p->next_ns = now;
+    }
+    p->next_ns += (uint64_t)gap;
+}
+
+//Sleep until the scheduled send time. The deadline is absolute, so oversleeping
+//on one packet does not push back the ones after it. Returns -1 if a signal
+//interrupted the sleep, 0 otherwise.
+int pacer_sleep (struct pacer *p) {
+    struct timespec deadline;
+    int err;
+
+    deadline.tv_sec = p->next_ns / ONE_BILLION;
+    deadline.tv_nsec = p->next_ns % ONE_BILLION;
+    err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    return err == EINTR ? -1 : 0;
+}
+
+//Wait until fd is readable or the monotonic clock reaches deadline_ns, with
+//nanosecond resolution. Returns 1 if fd is readable, 0 at the deadline, -1 on
+//error or a signal.
+int wait_readable (int fd, uint64_t deadline_ns) {
+    struct pollfd pfd;
+    struct timespec timeout;
+    uint64_t now = now_ns(), left;
+
+    left = deadline_ns > now ? deadline_ns - now : 0;
+    timeout.tv_sec = left / ONE_BILLION;
+    timeout.tv_nsec = left % ONE_BILLION;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    return ppoll(&pfd, 1, &timeout, NULL);
+}
+
+//Draws a time delay in nanoseconds from a uniform distribution: a whole
+//number of milliseconds within [0, b].
+uint64_t uniform_delay_ns(int b) {
+    int rand_num = 0;
     struct timeval curr_time;
     
-    l = exp(-1*mean);
     gettimeofday(&curr_time, NULL);
-    srand(curr_time.tv_usec); //seed random number generator with current time
-    
-    do {
-        rand_num = rand()/(double)RAND_MAX;
-        //printf("%s: The random number is %f\n", __func__, rand_num);
-        
-        p = p * rand_num;
-    } while (p > l);
-    
-    delay_time = -log(1.0 - rand_num)*mean;
-    //printf("*****%s delay is: %f milliseconds\n",__func__, delay_time);
-    usleep((useconds_t) (delay_time * 1000)); //usleep is in usec, want millisec
+    srand(curr_time.tv_usec); //seed randnum generator w/ current time
+    rand_num = rand()%(b+1);
+    return (uint64_t)rand_num * ONE_MILLION;
 }
 
 //Generates a time delay according to a uniform distribution.
 //Given an input b, will delay a random time within the uniform
 //distribution of [0, b].
 void uniform_delay(int b) {
-    int delay_time = 0, rand_num = 0;
-    struct timeval curr_time;
-    
-    gettimeofday(&curr_time, NULL);
-    srand(curr_time.tv_usec); //seed randnum generator w/ current time
-    rand_num = rand()%(b+1);
-    delay_time = rand_num * 1000; //get delay time in millisec
-    //printf("%s in util.c: uniform delay time is %d ms\n", __func__, delay_time/1000);
-    usleep((useconds_t) delay_time); 
+    uint64_t delay_time = uniform_delay_ns(b);
+
+    //printf("%s in util.c: uniform delay time is %d ms\n", __func__, (int)(delay_time / ONE_MILLION));
+    usleep((useconds_t)(delay_time / 1000)); 
 }
 
 //Function to retreive the port for a given receiver ID
@@ -117,13 +683,104 @@ char *get_receiver_port(unsigned int receiver_id) {
     return port_str; 
 }
 
-/*Function to obtain a running average, given a count of total elements and
- the cumulative sum of the elements themselves. Used by the router to 
- obtain the average length of each queue. Also used by the receiver to 
- obtain the  average packet delay from the sender to the receiver.*/
-unsigned int avg;
-unsigned int running_avg(unsigned int count, unsigned int cumulative) {
-    avg = cumulative / count;
-    //printf("%s in util.c: is currently %d\n",__func__, avg);
-    return avg; 
-}
\ No newline at end of file
+//Reset a histogram to hold no samples
+void hist_init (struct latency_hist *h) {
+    memset(h, 0, sizeof (struct latency_hist));
+    h->min = UINT64_MAX;
+}
+
+//Index of the bucket that holds value
+unsigned int hist_index (uint64_t value) {
+    unsigned int msb, shift;
+
+    if (value < HIST_SUB_COUNT) {
+        return value;
+    }
+    if (value >= (1ULL << HIST_MAX_BITS)) {
+        return HIST_BUCKETS - 1;
+    }
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - (HIST_SUB_BITS - 1);
+    //value >> shift is in [HIST_SUB_COUNT/2, HIST_SUB_COUNT)
+    return HIST_SUB_COUNT + (shift - 1) * (HIST_SUB_COUNT / 2) + (unsigned int)(value >> shift) - HIST_SUB_COUNT / 2;
+}
+
+//Largest value that falls in bucket index
+uint64_t hist_bucket_high (unsigned int index) {
+    unsigned int shift, sub;
+
+    if (index < HIST_SUB_COUNT) {
+        return index;
+    }
+    shift = (index - HIST_SUB_COUNT) / (HIST_SUB_COUNT / 2) + 1;
+    sub = (index - HIST_SUB_COUNT) % (HIST_SUB_COUNT / 2) + HIST_SUB_COUNT / 2;
+    return (((uint64_t)sub + 1) << shift) - 1;
+}
+
+//Record one sample, O(1) time and no allocation
+void hist_record (struct latency_hist *h, uint64_t value) {
+    h->counts[hist_index(value)]++;
+    h->total_count++;
+    h->sum += value;
+    if (value < h->min) {
+        h->min = value;
+    }
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+//Add every sample recorded in src to dst, e.g. to sum per-thread histograms
+void hist_merge (struct latency_hist *dst, struct latency_hist *src) {
+    unsigned int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+    dst->total_count += src->total_count;
+    dst->sum += src->sum;
+    if (src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+//Mean of all recorded samples
+double hist_mean (struct latency_hist *h) {
+    return h->total_count ? (double)h->sum / h->total_count : 0.0;
+}
+
+//Value at or below which percentile % of the samples fall (e.g. 99.9),
+//reported as the top of its bucket and never above the maximum seen
+uint64_t hist_percentile (struct latency_hist *h, double percentile) {
+    uint64_t rank, seen = 0, high;
+    unsigned int i;
+
+    if (h->total_count == 0) {
+        return 0;
+    }
+    rank = (uint64_t)ceil(percentile / 100.0 * h->total_count);
+    if (rank == 0) {
+        rank = 1;
+    }
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            high = hist_bucket_high(i);
+            return high < h->max ? high : h->max;
+        }
+    }
+    return h->max;
+}
+
+//Print the summary statistics of a histogram on one line
+void hist_print (struct latency_hist *h, const char *label, const char *unit) {
+    printf("%s: count %llu | mean %.1f %s | p50 %llu %s | p99 %llu %s | p99.9 %llu %s | max %llu %s\n",
+           label, (unsigned long long)h->total_count, hist_mean(h), unit,
+           (unsigned long long)hist_percentile(h, 50.0), unit,
+           (unsigned long long)hist_percentile(h, 99.0), unit,
+           (unsigned long long)hist_percentile(h, 99.9), unit,
+           (unsigned long long)h->max, unit);
+}